@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2021 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     apps
+ * @{
+ * @file
+ * @brief       Benchmark application for the saul_ts codec
+ *
+ * Encodes and decodes synthetic sensor series and reports the compression
+ * ratio against the raw samples and the cost per sample, in ns and in
+ * cycles of the TSC on x86 hosts (0 elsewhere). Every result is
+ * printed as a single JSON object per line so runs can be diffed or parsed
+ * by a script.
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "kernel_defines.h"
+#include "phydat.h"
+#include "ztimer.h"
+
+#include "saul_ts.h"
+
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES               (1024U)
+#endif
+
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS                (16U)
+#endif
+
+typedef struct {
+    const char *name;
+    uint8_t dim;
+    uint8_t unit;
+    int8_t scale;
+    uint32_t period;            /**< ms between samples */
+    void (*next)(int16_t *val, uint32_t i);
+} bench_series_t;
+
+static uint32_t _times[BENCH_SAMPLES];
+static phydat_t _samples[BENCH_SAMPLES];
+static uint8_t _stream[BENCH_SAMPLES * SAUL_TS_SAMPLE_MAX];
+static uint32_t _seed = 1;
+
+/* deterministic, so runs can be compared */
+static uint32_t _rand(uint32_t range)
+{
+    _seed = _seed * 1103515245 + 12345;
+    return (_seed >> 16) % range;
+}
+
+static int16_t _noise(uint32_t amplitude)
+{
+    return (int16_t)_rand(2 * amplitude + 1) - (int16_t)amplitude;
+}
+
+/* slow drift of +-2 degrees around 21.50 with sensor noise */
+static void _temperature(int16_t *val, uint32_t i)
+{
+    int32_t drift = (i % 400) < 200 ? (i % 200) : 200 - (i % 200);
+    val[0] = 2050 + drift + _noise(2);
+}
+
+/* random walk with occasional spikes */
+static void _pm(int16_t *val, uint32_t i)
+{
+    static int16_t level = 12;
+
+    (void)i;
+    level += _noise(1);
+    if (level < 0) {
+        level = 0;
+    }
+    val[0] = level + (_rand(50) ? 0 : (int16_t)_rand(200));
+}
+
+/* device at rest, 1g on z */
+static void _acceleration(int16_t *val, uint32_t i)
+{
+    (void)i;
+    val[0] = _noise(20);
+    val[1] = _noise(20);
+    val[2] = 1000 + _noise(20);
+}
+
+static const bench_series_t _series[] = {
+    { "temperature", 1, UNIT_TEMP_C, -2, 5 * MS_PER_SEC, _temperature },
+    { "pm2p5", 1, UNIT_GPM3, -6, 5 * MS_PER_SEC, _pm },
+    { "acceleration", 3, UNIT_G, -3, 100, _acceleration },
+};
+
+static uint64_t _cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void _generate(const bench_series_t *series)
+{
+    uint32_t time = 0;
+
+    _seed = 1;
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        /* a few ms of scheduling jitter */
+        time += series->period + _noise(3);
+        _times[i] = time;
+        memset(&_samples[i], 0, sizeof(_samples[i]));
+        series->next(_samples[i].val, i);
+        _samples[i].unit = series->unit;
+        _samples[i].scale = series->scale;
+    }
+}
+
+static size_t _encode(uint8_t dim)
+{
+    saul_ts_encoder_t enc;
+
+    saul_ts_encoder_init(&enc, _stream, sizeof(_stream));
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        saul_ts_encode(&enc, _times[i], &_samples[i], dim);
+    }
+    return saul_ts_encoder_len(&enc);
+}
+
+static unsigned _decode(size_t len, uint8_t dim)
+{
+    saul_ts_decoder_t dec;
+    unsigned errors = 0;
+    uint32_t time;
+    phydat_t data;
+
+    saul_ts_decoder_init(&dec, _stream, len);
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        if (saul_ts_decode(&dec, &time, &data) != dim ||
+            time != _times[i] ||
+            memcmp(data.val, _samples[i].val, dim * sizeof(data.val[0]))) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static void _bench_series(const bench_series_t *series)
+{
+    /* time, values, unit and scale */
+    size_t raw = BENCH_SAMPLES * (sizeof(uint32_t) +
+                                  series->dim * sizeof(int16_t) + 2);
+    size_t len = 0;
+    unsigned errors = 0;
+
+    _generate(series);
+
+    uint64_t cycles = _cycles();
+    uint32_t start = ztimer_now(ZTIMER_USEC);
+    for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+        len = _encode(series->dim);
+    }
+    uint32_t enc_us = ztimer_now(ZTIMER_USEC) - start;
+    uint64_t enc_cycles = _cycles() - cycles;
+
+    cycles = _cycles();
+    start = ztimer_now(ZTIMER_USEC);
+    for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+        errors = _decode(len, series->dim);
+    }
+    uint32_t dec_us = ztimer_now(ZTIMER_USEC) - start;
+    uint64_t dec_cycles = _cycles() - cycles;
+
+    const uint32_t samples = BENCH_SAMPLES * BENCH_ROUNDS;
+    printf("{\"bench\":\"codec\",\"series\":\"%s\",\"dim\":%u,"
+           "\"samples\":%u,\"raw_bytes\":%u,\"encoded_bytes\":%u,"
+           "\"ratio_x100\":%u,\"bits_per_sample\":%u,"
+           "\"encode_ns\":%" PRIu32 ",\"decode_ns\":%" PRIu32 ","
+           "\"encode_cycles\":%" PRIu32 ",\"decode_cycles\":%" PRIu32 ","
+           "\"errors\":%u}\n",
+           series->name, series->dim, BENCH_SAMPLES, (unsigned)raw,
+           (unsigned)len, (unsigned)(raw * 100 / len),
+           (unsigned)(len * 8 / BENCH_SAMPLES),
+           (uint32_t)((uint64_t)enc_us * NS_PER_US / samples),
+           (uint32_t)((uint64_t)dec_us * NS_PER_US / samples),
+           (uint32_t)(enc_cycles / samples), (uint32_t)(dec_cycles / samples),
+           errors);
+}
+
+int main(void)
+{
+    puts("saul_ts benchmark application");
+
+    for (unsigned i = 0; i < ARRAY_SIZE(_series); i++) {
+        _bench_series(&_series[i]);
+    }
+
+    puts("{\"bench\":\"done\"}");
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2021 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     apps
+ * @{
+ * @file
+ * @brief       Benchmark application for schedreg
+ *
+ * Registers a growing number of entries with mixed periods and measures the
+ * register/unregister cost, the dispatch latency and jitter against the
+ * absolute deadline grid and the callback throughput. Every result is
+ * printed as a single JSON object per line so runs of different backends
+ * can be diffed or parsed by a script.
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "kernel_defines.h"
+#include "ztimer.h"
+
+#include "schedreg.h"
+
+#ifndef BENCH_ENTRIES_MAX
+#define BENCH_ENTRIES_MAX           (CONFIG_SCHEDREG_NUMOF)
+#endif
+
+#ifndef BENCH_DURATION
+#define BENCH_DURATION              (2 * MS_PER_SEC)
+#endif
+
+#ifndef BENCH_BACKEND
+#define BENCH_BACKEND               "default"
+#endif
+
+#ifndef BENCH_WORKERS
+#define BENCH_WORKERS               0
+#endif
+
+typedef struct {
+    schedreg_t reg;
+    ztimer_t timer;
+    msg_t msg;
+    uint32_t runs;
+    uint32_t lat_min;
+    uint32_t lat_max;
+    uint64_t lat_total;
+    uint32_t lat_last;
+    uint64_t jitter_total;
+} bench_entry_t;
+
+static const uint32_t _periods[] = { 10, 20, 50, 100, 200, 500 };
+static const unsigned _sizes[] = { 1, 8, 32, 128, BENCH_ENTRIES_MAX };
+
+static bench_entry_t _entries[BENCH_ENTRIES_MAX];
+static kernel_pid_t _sched_pid;
+static uint32_t _offset_us;
+
+/**
+ * @brief   Offset between ZTIMER_USEC and ZTIMER_MSEC, taken on a
+ *          millisecond edge so deadlines can be compared in microseconds
+ */
+static void _calibrate(void)
+{
+    uint32_t ms = ztimer_now(ZTIMER_MSEC);
+
+    while (ztimer_now(ZTIMER_MSEC) == ms) {}
+    _offset_us = ztimer_now(ZTIMER_USEC) - (ms + 1) * US_PER_MS;
+}
+
+static void _bench_cb(void *arg)
+{
+    bench_entry_t *b = arg;
+    uint32_t now_us = ztimer_now(ZTIMER_USEC) - _offset_us;
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    /* entries are on the absolute grid with phase 0 */
+    int32_t lat = now_us - (now - now % b->reg.period) * US_PER_MS;
+
+    if (lat < 0) {
+        lat = 0;
+    }
+    if (b->runs) {
+        b->jitter_total += (uint32_t)lat > b->lat_last ?
+                           (uint32_t)lat - b->lat_last :
+                           b->lat_last - (uint32_t)lat;
+    }
+    b->lat_last = lat;
+    b->lat_total += lat;
+    if ((uint32_t)lat < b->lat_min) {
+        b->lat_min = lat;
+    }
+    if ((uint32_t)lat > b->lat_max) {
+        b->lat_max = lat;
+    }
+    b->runs++;
+}
+
+static void _entries_init(unsigned numof)
+{
+    for (unsigned i = 0; i < numof; i++) {
+        bench_entry_t *b = &_entries[i];
+        schedreg_init_pid(&b->reg, _bench_cb, b, &b->msg, &b->timer,
+                          _periods[i % ARRAY_SIZE(_periods)]);
+        schedreg_set_absolute(&b->reg, 0);
+        b->runs = 0;
+        b->lat_min = UINT32_MAX;
+        b->lat_max = 0;
+        b->lat_total = 0;
+        b->lat_last = 0;
+        b->jitter_total = 0;
+    }
+}
+
+static void _print_head(const char *bench, unsigned numof)
+{
+    printf("{\"bench\":\"%s\",\"backend\":\"%s\",\"workers\":%u,\"n\":%u",
+           bench, BENCH_BACKEND, BENCH_WORKERS, numof);
+}
+
+/**
+ * @brief   Bytes used per entry with this backend, by the caller and by the
+ *          module tables
+ */
+static void _bench_ram(void)
+{
+    size_t bytes = sizeof(schedreg_t);
+
+#ifndef MODULE_SCHEDREG_SINGLE_TIMER
+    bytes += sizeof(ztimer_t);
+#if !defined(MODULE_SCHEDREG_EVENT)
+    bytes += sizeof(msg_t);
+#endif
+#endif
+    /* plus the share of the module tables, reserved for every slot */
+    bytes += schedreg_slot_bytes();
+    _print_head("ram", 1);
+    printf(",\"schedreg_bytes\":%u,\"slot_bytes\":%u,\"entry_bytes\":%u}\n",
+           (unsigned)sizeof(schedreg_t), (unsigned)schedreg_slot_bytes(),
+           (unsigned)bytes);
+}
+
+static void _bench_register(unsigned numof)
+{
+    uint32_t reg_us;
+    uint32_t unreg_us;
+    unsigned failed = 0;
+
+    _entries_init(numof);
+    /* large periods so nothing is dispatched while measuring */
+    for (unsigned i = 0; i < numof; i++) {
+        _entries[i].reg.period = 60 * MS_PER_SEC;
+    }
+
+    uint32_t start = ztimer_now(ZTIMER_USEC);
+    for (unsigned i = 0; i < numof; i++) {
+        if (schedreg_register(&_entries[i].reg, _sched_pid)) {
+            failed++;
+        }
+    }
+    reg_us = ztimer_now(ZTIMER_USEC) - start;
+
+    start = ztimer_now(ZTIMER_USEC);
+    for (unsigned i = 0; i < numof; i++) {
+        schedreg_unregister(&_entries[i].reg);
+    }
+    unreg_us = ztimer_now(ZTIMER_USEC) - start;
+
+    _print_head("register", numof);
+    printf(",\"register_us\":%" PRIu32 ",\"register_ns_op\":%" PRIu32
+           ",\"unregister_us\":%" PRIu32 ",\"unregister_ns_op\":%" PRIu32
+           ",\"failed\":%u}\n",
+           reg_us, reg_us * NS_PER_US / numof,
+           unreg_us, unreg_us * NS_PER_US / numof, failed);
+}
+
+static void _bench_dispatch(unsigned numof)
+{
+    schedreg_wakeup_stats_t before;
+    schedreg_wakeup_stats_t after;
+    uint32_t expected = 0;
+    uint32_t runs = 0;
+    uint32_t lat_min = UINT32_MAX;
+    uint32_t lat_max = 0;
+    uint64_t lat_total = 0;
+    uint64_t jitter_total = 0;
+    uint32_t jitter_samples = 0;
+
+    _entries_init(numof);
+    for (unsigned i = 0; i < numof; i++) {
+        expected += BENCH_DURATION / _entries[i].reg.period;
+    }
+
+    schedreg_wakeup_stats(&before);
+    for (unsigned i = 0; i < numof; i++) {
+        schedreg_register(&_entries[i].reg, _sched_pid);
+    }
+    ztimer_sleep(ZTIMER_MSEC, BENCH_DURATION);
+    for (unsigned i = 0; i < numof; i++) {
+        schedreg_unregister(&_entries[i].reg);
+    }
+    schedreg_wakeup_stats(&after);
+
+    for (unsigned i = 0; i < numof; i++) {
+        bench_entry_t *b = &_entries[i];
+        if (b->runs == 0) {
+            continue;
+        }
+        runs += b->runs;
+        lat_total += b->lat_total;
+        jitter_total += b->jitter_total;
+        jitter_samples += b->runs - 1;
+        if (b->lat_min < lat_min) {
+            lat_min = b->lat_min;
+        }
+        if (b->lat_max > lat_max) {
+            lat_max = b->lat_max;
+        }
+    }
+    if (runs == 0) {
+        lat_min = 0;
+    }
+
+    _print_head("dispatch", numof);
+    printf(",\"duration_ms\":%u,\"expected\":%" PRIu32 ",\"runs\":%" PRIu32
+           ",\"runs_per_s\":%" PRIu32 ",\"lat_min_us\":%" PRIu32
+           ",\"lat_avg_us\":%" PRIu32 ",\"lat_max_us\":%" PRIu32
+           ",\"jitter_us\":%" PRIu32 ",\"wakeups\":%" PRIu32
+           ",\"saved\":%" PRIu32 ",\"dropped\":%" PRIu32 "}\n",
+           (unsigned)BENCH_DURATION, expected, runs,
+           (uint32_t)((uint64_t)runs * MS_PER_SEC / BENCH_DURATION),
+           lat_min, runs ? (uint32_t)(lat_total / runs) : 0, lat_max,
+           jitter_samples ? (uint32_t)(jitter_total / jitter_samples) : 0,
+           after.wakeups - before.wakeups, after.saved - before.saved,
+           after.dropped - before.dropped);
+}
+
+/**
+ * @brief   Runs @p bench for every size up to BENCH_ENTRIES_MAX
+ */
+static void _bench_sizes(void (*bench)(unsigned))
+{
+    unsigned last = 0;
+
+    for (unsigned i = 0; i < ARRAY_SIZE(_sizes); i++) {
+        if (_sizes[i] > BENCH_ENTRIES_MAX || _sizes[i] <= last) {
+            continue;
+        }
+        bench(_sizes[i]);
+        last = _sizes[i];
+    }
+}
+
+int main(void)
+{
+    puts("schedreg benchmark application");
+
+    _sched_pid = init_schedreg_thread();
+    _calibrate();
+
+    _bench_ram();
+    _bench_sizes(_bench_register);
+    _bench_sizes(_bench_dispatch);
+
+    puts("{\"bench\":\"done\"}");
+    return 0;
+}
@@ -28,61 +28,72 @@
 #endif
 
 #define BEACON_SEND_INTERVAL    (30 * MS_PER_SEC)
+/* Periodic jobs this close to a wakeup are run within that same wakeup */
+#define BEACON_SEND_SLACK       (5 * MS_PER_SEC)
+#define SAUL_SEND_SLACK         (1 * MS_PER_SEC)
+/* Random spread on top of the per node phase, kept within the slack so
+   the sensors of a node still share wakeups */
+#define SAUL_SEND_JITTER        (SAUL_SEND_SLACK)
 
 #define MAIN_QUEUE_SIZE       (8)
 static msg_t _main_msg_queue[MAIN_QUEUE_SIZE];
 
-static uint8_t _saul_list[][2] = {
-    {SAUL_SENSE_CO2, SAUL_CLASS_ANY},
-    {SAUL_SENSE_HUM, SAUL_CLASS_ANY},
-    {SAUL_SENSE_LIGHT, SAUL_CLASS_ANY},
-    {SAUL_SENSE_PM, SAUL_SENSE_PM_10},
-    {SAUL_SENSE_PM, SAUL_SENSE_PM_1},
-    {SAUL_SENSE_PM, SAUL_SENSE_PM_2p5},
-    {SAUL_SENSE_PRESS, SAUL_CLASS_ANY},
-    {SAUL_SENSE_TEMP, SAUL_CLASS_ANY},
-    {SAUL_SENSE_TVOC, SAUL_CLASS_ANY},
+/* Slowly changing values are only reported when they move by 0.5%, or
+   every 5 minutes */
+static const saul_coap_policy_t _slow_policy = {
+    .abs_delta = 0,
+    .rel_delta = 5,
+    .min_interval = 0,
+    .heartbeat = 5 * 60 * MS_PER_SEC,
 };
 
-static const uint32_t _send_int[] = {
-    (6*MS_PER_SEC),  /* ECO2_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* HUM_SEND_INTERVAL */
-    (10*MS_PER_SEC), /* LIGHT_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* PM10_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* PM1_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* PM2.5_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* PRESS_SEND_INTERVAL */
-    (5*MS_PER_SEC),  /* TEMP_SEND_INTERVAL */
-    (6*MS_PER_SEC),  /* TVOC_SEND_INTERVAL */
-};
+/* Send the readings due within this window in a single message, 0 sends
+   every sensor on its own */
+#ifndef SAUL_SEND_BATCH_WINDOW
+#define SAUL_SEND_BATCH_WINDOW  (1 * MS_PER_SEC)
+#endif
 
-/* CoAP resources (alphabetical order) */
+/* CoAP resources (alphabetical order), the SAUL ones are generated from
+   the devices present on the board */
 static const coap_resource_t _resources[] = {
     { "/board", COAP_GET, board_handler, NULL },
-    { "/eco2", COAP_GET, saul_coap_handler, &_saul_list[0][0]},
-    { "/humidity", COAP_GET, saul_coap_handler, &_saul_list[1][0] },
-    { "/light", COAP_GET, saul_coap_handler, &_saul_list[2][0] },
+#ifdef MODULE_COAP_SAUL_LOG
+    { "/log", COAP_GET, saul_coap_log_handler, NULL },
+#endif
     { "/mcu", COAP_GET, mcu_handler, NULL },
     { "/name", COAP_GET, name_handler, NULL },
     { "/os", COAP_GET, os_handler, NULL },
-    { "/pm10", COAP_GET, saul_coap_handler, &_saul_list[3][0] },
-    { "/pm1", COAP_GET, saul_coap_handler, &_saul_list[4][0] },
-    { "/pm2.5", COAP_GET, saul_coap_handler, &_saul_list[5][0] },
     { "/position", COAP_GET, position_handler, NULL },
-    { "/pressure", COAP_GET, saul_coap_handler, &_saul_list[6][0] },
+#ifdef MODULE_COAP_SAUL_LATENCY
+    { "/saul/latency", COAP_GET, saul_coap_latency_handler, NULL },
+#endif
+#ifdef MODULE_SCHEDREG_STATS
+    { "/schedreg/stats", COAP_GET, schedreg_stats_handler, NULL },
+#endif
 #ifdef MODULE_COAP_SUIT
     /* this line adds the whole "/suit"-subtree */
     SUIT_COAP_SUBTREE,
     { "/suit_state", COAP_GET, suit_state_handler, (void*) NULL },
 #endif
-    { "/temperature", COAP_GET, saul_coap_handler, &_saul_list[7][0] },
-    { "/tvoc", COAP_GET, saul_coap_handler, &_saul_list[8][0]},
 #ifdef MODULE_COAP_SUIT
     { "/vendor", COAP_GET, vendor_handler, NULL },
     { "/version", COAP_GET, version_handler, NULL },
 #endif
 };
 
+static const shell_command_t _commands[] = {
+#ifdef MODULE_SCHEDREG_STATS
+    { "schedreg", "Print periodic jobs statistics", schedreg_stats_cmd },
+#endif
+    { "saulrep", "Print sent and suppressed sensor reports",
+      saul_coap_report_cmd },
+#ifdef MODULE_COAP_SAUL_LATENCY
+    { "saullat", "Print sensor read latency histograms",
+      saul_coap_latency_cmd },
+#endif
+    { NULL, NULL, NULL }
+};
+
 static gcoap_listener_t _listener = {
     (coap_resource_t *)&_resources[0],
     sizeof(_resources) / sizeof(_resources[0]),
@@ -100,6 +111,14 @@ int main(void)
 
     /* start coap server loop */
     gcoap_register_listener(&_listener);
+    saul_coap_sensor_t *sensors;
+    unsigned sensors_numof = saul_coap_auto_init(&sensors);
+    for (unsigned i = 0; i < sensors_numof; i++) {
+        if (sensors[i].type == SAUL_SENSE_PRESS ||
+            sensors[i].type == SAUL_SENSE_TEMP) {
+            sensors[i].policy = &_slow_policy;
+        }
+    }
 
 #ifdef MODULE_COAP_SUIT
     printf("running from slot %u\n", riotboot_slot_current());
@@ -112,30 +131,55 @@ int main(void)
     kernel_pid_t sched_pid = init_schedreg_thread();
     /* start beacon and register */
     init_beacon_sender();
-    ztimer_t beacon_ztimer;
-    msg_t beacon_msg;
-    schedreg_t beacon_reg = SCHEDREG_INIT(beacon_handler, NULL, &beacon_msg,
-                                          &beacon_ztimer, BEACON_SEND_INTERVAL);
+    schedreg_t beacon_reg = SCHEDREG_INIT(beacon_handler, NULL, NULL, NULL,
+                                          BEACON_SEND_INTERVAL);
+    schedreg_set_slack(&beacon_reg, BEACON_SEND_SLACK);
+    schedreg_set_node_phase(&beacon_reg, 0);
+    schedreg_set_prio(&beacon_reg, SCHEDREG_PRIO_HIGH, 0);
     schedreg_register(&beacon_reg, sched_pid);
 
-    /* register saul sensors if there is one */
-    /* TODO: a lot of wasted memory if no saul device is present... */
-    ztimer_t timer[ARRAY_SIZE(_send_int)];
-    msg_t msgs[ARRAY_SIZE(_send_int)];
-    schedreg_t saul_reg[ARRAY_SIZE(_send_int)];
-
-    for (uint8_t i = 0; i < ARRAY_SIZE(_send_int); i++)
-    {
-        schedreg_init_pid(&saul_reg[i], saul_coap_send, &_saul_list[i][0],
-            &msgs[i], &timer[i], _send_int[i]);
-        if (saul_reg_find_type_and_subtype(_saul_list[i][0], _saul_list[i][1])) {
-            schedreg_register(&saul_reg[i], sched_pid);
-        }
+    /* register saul sensors */
+#if SAUL_SEND_BATCH_WINDOW
+    saul_coap_batch_item_t batch_items[CONFIG_COAP_SAUL_AUTO_NUMOF];
+    saul_coap_batch_t batch;
+    schedreg_t batch_reg;
+
+    /* items are spread over their own interval, the batch period is only
+       the greatest common divisor of the intervals */
+    uint32_t offset = schedreg_node_offset(SAUL_SEND_JITTER);
+
+    saul_coap_batch_init(&batch, batch_items, ARRAY_SIZE(batch_items),
+                         SAUL_SEND_BATCH_WINDOW);
+    saul_coap_batch_set_phase(&batch, offset);
+    for (unsigned i = 0; i < sensors_numof; i++) {
+        saul_coap_batch_add(&batch, &sensors[i],
+                            saul_coap_default_interval(&sensors[i]));
     }
+    if (batch.numof) {
+        schedreg_init_pid(&batch_reg, saul_coap_batch_send, &batch, NULL, NULL,
+                          saul_coap_batch_period(&batch));
+        schedreg_set_slack(&batch_reg, SAUL_SEND_SLACK);
+        /* ticks on the item deadlines, which are aligned on the same offset
+           modulo multiples of the period */
+        schedreg_set_absolute(&batch_reg,
+                              offset % saul_coap_batch_period(&batch));
+        schedreg_register(&batch_reg, sched_pid);
+    }
+#else
+    schedreg_t saul_reg[CONFIG_COAP_SAUL_AUTO_NUMOF];
+
+    for (unsigned i = 0; i < sensors_numof; i++) {
+        schedreg_init_pid(&saul_reg[i], saul_coap_send, &sensors[i],
+            NULL, NULL, saul_coap_default_interval(&sensors[i]));
+        schedreg_set_slack(&saul_reg[i], SAUL_SEND_SLACK);
+        schedreg_set_node_phase(&saul_reg[i], SAUL_SEND_JITTER);
+        schedreg_register(&saul_reg[i], sched_pid);
+    }
+#endif
 
     puts("All up, running the shell now");
     char line_buf[SHELL_DEFAULT_BUFSIZE];
-    shell_run(NULL, line_buf, SHELL_DEFAULT_BUFSIZE);
+    shell_run(_commands, line_buf, SHELL_DEFAULT_BUFSIZE);
 
     return 0;
 }
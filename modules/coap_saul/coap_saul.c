@@ -1,23 +1,132 @@
+#include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "bitarithm.h"
 #include "fmt.h"
+#include "irq.h"
+#include "kernel_defines.h"
+#include "mutex.h"
+#include "thread.h"
 #include "saul.h"
 #include "saul_reg.h"
 #include "net/gcoap.h"
+#include "ztimer.h"
+#ifdef MODULE_COAP_SAUL_SENML
+#include "nanocbor/nanocbor.h"
+#endif
+#if defined(MODULE_COAP_SAUL_LOG) && !defined(MODULE_COAP_SAUL_LOG_MTD)
+#include "random.h"
+#endif
 
+#include "coap_saul.h"
 #include "coap_utils.h"
 
 #define ENABLE_DEBUG (0)
 #include "debug.h"
 
+/**
+ * @brief   Largest encoded reading, text or SenML-CBOR
+ */
+#ifdef MODULE_COAP_SAUL_STATS
+#define COAP_SAUL_PAYLOAD_LEN       (256U)
+#else
+#define COAP_SAUL_PAYLOAD_LEN       (128U)
+#endif
+
+/**
+ * @brief   Fractional bits of the aggregated mean
+ */
+#define COAP_SAUL_STATS_FRAC        (8U)
+
+/**
+ * @brief   Samples aggregated per window, later ones are dropped
+ *
+ * The Q16 sum of squares of n samples spanning the 2^24 range of a Q8
+ * int16_t is at most n * 2^46, 2^15 samples keep it far below INT64_MAX.
+ */
+#define COAP_SAUL_STATS_COUNT_MAX   (INT16_MAX)
+
+/**
+ * @brief   SenML labels, RFC 8428 Table 4
+ */
+#define SENML_LABEL_NAME            (0)
+#define SENML_LABEL_UNIT            (1)
+#define SENML_LABEL_VALUE           (2)
+
+/**
+ * @brief   CBOR header of a SenML pack of @p n < 24 records
+ */
+#define SENML_PACK_HDR(n)           (0x80 | (n))
+#define SENML_PACK_MAX              (23U)
+
+typedef struct {
+    uint8_t type;
+    uint8_t subtype;
+    const char *name;
+    const char *path;
+    uint32_t interval;
+} saul_coap_name_t;
+
+/* names used in reports, resource paths and default report intervals,
+   sorted by path as gcoap expects. SAUL_CLASS_ANY matches any subtype */
+static const saul_coap_name_t _names[] = {
+    { SAUL_SENSE_ACCEL, SAUL_CLASS_ANY, "acceleration", "/acceleration",
+      1 * MS_PER_SEC },
+    { SAUL_SENSE_GYRO, SAUL_CLASS_ANY, "angular_rate", "/angular_rate",
+      1 * MS_PER_SEC },
+    { SAUL_SENSE_CO2, SAUL_CLASS_ANY, "eco2", "/eco2", 6 * MS_PER_SEC },
+    { SAUL_SENSE_HUM, SAUL_CLASS_ANY, "humidity", "/humidity",
+      5 * MS_PER_SEC },
+    { SAUL_SENSE_LIGHT, SAUL_CLASS_ANY, "illuminance", "/light",
+      10 * MS_PER_SEC },
+    { SAUL_SENSE_MAG, SAUL_CLASS_ANY, "magnetic_field", "/magnetic_field",
+      1 * MS_PER_SEC },
+    { SAUL_SENSE_PM, SAUL_SENSE_PM_1, "pm1", "/pm1", 5 * MS_PER_SEC },
+    { SAUL_SENSE_PM, SAUL_SENSE_PM_10, "pm10", "/pm10", 5 * MS_PER_SEC },
+    { SAUL_SENSE_PM, SAUL_SENSE_PM_2p5, "pm2p5", "/pm2.5", 5 * MS_PER_SEC },
+    { SAUL_SENSE_PRESS, SAUL_CLASS_ANY, "pressure", "/pressure",
+      5 * MS_PER_SEC },
+    { SAUL_SENSE_TEMP, SAUL_CLASS_ANY, "temperature", "/temperature",
+      5 * MS_PER_SEC },
+    { SAUL_SENSE_TVOC, SAUL_CLASS_ANY, "tvoc", "/tvoc", 6 * MS_PER_SEC },
+};
+
+static const saul_coap_name_t *_saul_find_name(uint8_t type, uint8_t subtype)
+{
+    for (unsigned i = 0; i < ARRAY_SIZE(_names); i++) {
+        if (_names[i].type == type &&
+            (_names[i].subtype == SAUL_CLASS_ANY ||
+             _names[i].subtype == subtype)) {
+            return &_names[i];
+        }
+    }
+    return NULL;
+}
+
+static const char *_saul_name(uint8_t type, uint8_t subtype)
+{
+    const saul_coap_name_t *entry = _saul_find_name(type, subtype);
+    return entry ? entry->name : NULL;
+}
+
+uint32_t saul_coap_default_interval(const saul_coap_sensor_t *sensor)
+{
+    const saul_coap_name_t *entry = _saul_find_name(sensor->type,
+                                                    sensor->subtype);
+    return entry ? entry->interval : CONFIG_COAP_SAUL_DEFAULT_INTERVAL;
+}
+
 ssize_t _saul_gcoap_response(coap_pkt_t* pdu, uint8_t *buf, size_t len,
-                             void *ctx, uint8_t* payload, size_t payload_len)
+                             uint16_t format, uint32_t max_age,
+                             uint8_t* payload, size_t payload_len)
 {
-    (void)ctx;
     gcoap_resp_init(pdu, buf, len, COAP_CODE_CONTENT);
-    coap_opt_add_format(pdu, COAP_FORMAT_TEXT);
+    coap_opt_add_format(pdu, format);
+    coap_opt_add_uint(pdu, COAP_OPT_MAX_AGE, max_age);
     size_t resp_len = coap_opt_finish(pdu, COAP_OPT_FINISH_PAYLOAD);
     if (pdu->payload_len >= payload_len) {
         memcpy(pdu->payload, payload, payload_len);
@@ -30,31 +139,657 @@ ssize_t _saul_gcoap_response(coap_pkt_t* pdu, uint8_t *buf, size_t len,
     }
 }
 
-static ssize_t _read_saul_data_str(uint8_t *buf, uint8_t type, uint8_t subtype)
+static saul_coap_sensor_t *_sensors;
+static unsigned _sensors_numof;
+static coap_utils_uri_t _server_uri;
+/* serializes the snapshot writers and guards the window aggregates,
+   readers never take it */
+static mutex_t _snap_lock = MUTEX_INIT;
+#ifdef MODULE_COAP_SAUL_SAMPLER
+static void _sampler_init(void);
+#endif
+
+static void _saul_bind(saul_coap_sensor_t *sensor)
 {
     /* get first sensor of <type> */
-    saul_reg_t *saul = saul_reg_find_type_and_subtype(type, subtype);
-    if ((saul == NULL)) {
-        DEBUG("[ERROR] Unable to find sensors of type,subtype %02x, %02x\n",
-              type, subtype);
-        return -1;
+    saul_reg_t *dev = saul_reg_find_type_and_subtype(sensor->type,
+                                                     sensor->subtype);
+
+    sensor->name = _saul_name(sensor->type, sensor->subtype);
+    if (dev == sensor->dev) {
+        /* readings, reports and statistics of the device stay valid */
+        return;
+    }
+
+    mutex_lock(&sensor->read_lock);
+#ifdef MODULE_COAP_SAUL_LATENCY
+    /* the histogram belongs to the device */
+    memset(sensor->read_hist, 0, sizeof(sensor->read_hist));
+    sensor->read_max = 0;
+    sensor->read_errors = 0;
+#endif
+    mutex_lock(&_snap_lock);
+    sensor->snap[0].dim = 0;
+    sensor->snap[1].dim = 0;
+    /* readers copying a snapshot meanwhile retry */
+    __atomic_fetch_add(&sensor->seq, 1, __ATOMIC_RELEASE);
+#ifdef MODULE_COAP_SAUL_SAMPLER
+    sensor->next_sample = ztimer_now(ZTIMER_MSEC);
+#endif
+    sensor->reported_dim = 0;
+#ifdef MODULE_COAP_SAUL_STATS
+    sensor->stats.count = 0;
+    sensor->stats_closed.count = 0;
+#endif
+    sensor->dev = dev;
+    mutex_unlock(&_snap_lock);
+    mutex_unlock(&sensor->read_lock);
+
+    if (dev == NULL) {
+        DEBUG("[DEBUG] No sensor of type,subtype %02x, %02x\n",
+              sensor->type, sensor->subtype);
+    }
+}
+
+void saul_coap_init(saul_coap_sensor_t *sensors, unsigned numof)
+{
+    _sensors = sensors;
+    _sensors_numof = numof;
+    coap_utils_uri_init(&_server_uri, "/server",
+                        CONFIG_COAP_SAUL_SEND_FORMAT);
+    saul_coap_rebind();
+#ifdef MODULE_COAP_SAUL_SAMPLER
+    _sampler_init();
+#endif
+}
+
+void saul_coap_rebind(void)
+{
+    for (unsigned i = 0; i < _sensors_numof; i++) {
+        _saul_bind(&_sensors[i]);
+    }
+}
+
+int saul_coap_reg_add(saul_reg_t *dev)
+{
+    int res = saul_reg_add(dev);
+    if (res == 0) {
+        saul_coap_rebind();
+    }
+    return res;
+}
+
+int saul_coap_reg_rm(saul_reg_t *dev)
+{
+    int res = saul_reg_rm(dev);
+    if (res == 0) {
+        saul_coap_rebind();
+    }
+    return res;
+}
+
+#ifdef MODULE_COAP_SAUL_AUTO
+static saul_coap_sensor_t _auto_sensors[CONFIG_COAP_SAUL_AUTO_NUMOF];
+static coap_resource_t _auto_resources[CONFIG_COAP_SAUL_AUTO_NUMOF];
+static gcoap_listener_t _auto_listener;
+
+/* link attributes of the generated resources in /.well-known/core */
+#ifdef MODULE_COAP_SAUL_SENML
+#define SAUL_COAP_LINK_CT   ";ct=\"0 112\""
+#else
+#define SAUL_COAP_LINK_CT   ";ct=0"
+#endif
+#ifdef MODULE_COAP_SAUL_OBSERVE
+#define SAUL_COAP_LINK_OBS  ";obs"
+#else
+#define SAUL_COAP_LINK_OBS  ""
+#endif
+static const char _link_attrs[] = SAUL_COAP_LINK_CT SAUL_COAP_LINK_OBS;
+
+static ssize_t _auto_link_encoder(const coap_resource_t *resource, char *buf,
+                                  size_t maxlen,
+                                  coap_link_encoder_ctx_t *context)
+{
+    ssize_t res = gcoap_encode_link(resource, buf, maxlen, context);
+
+    if (res <= 0) {
+        return res;
+    }
+    /* buf is NULL when gcoap only asks for the length */
+    if (buf) {
+        if ((size_t)res + sizeof(_link_attrs) - 1 > maxlen) {
+            return -1;
+        }
+        memcpy(buf + res, _link_attrs, sizeof(_link_attrs) - 1);
+    }
+    return res + sizeof(_link_attrs) - 1;
+}
+
+unsigned saul_coap_auto_init(saul_coap_sensor_t **sensors)
+{
+    uint32_t present = 0;
+    unsigned numof = 0;
+
+    /* mark every known type found in the registry, a single resource is
+       generated per type as sensors bind to the first matching device */
+    for (saul_reg_t *dev = saul_reg; dev; dev = dev->next) {
+        const saul_coap_name_t *entry = _saul_find_name(dev->driver->type,
+                                                        dev->driver->subtype);
+        if (entry) {
+            present |= 1UL << (entry - _names);
+        }
+    }
+
+    /* _names is sorted by path, so is the generated table */
+    for (unsigned i = 0; i < ARRAY_SIZE(_names); i++) {
+        if (!(present & (1UL << i))) {
+            continue;
+        }
+        if (numof == CONFIG_COAP_SAUL_AUTO_NUMOF) {
+            printf("WARNING: %s not exposed, raise "
+                   "CONFIG_COAP_SAUL_AUTO_NUMOF\n", _names[i].path);
+            continue;
+        }
+        saul_coap_sensor_t *sensor = &_auto_sensors[numof];
+        *sensor = (saul_coap_sensor_t)SAUL_COAP_SENSOR(_names[i].type,
+                                                        _names[i].subtype);
+        _auto_resources[numof] = (coap_resource_t) {
+            .path = _names[i].path,
+            .methods = COAP_GET,
+            .handler = saul_coap_handler,
+            .context = sensor,
+        };
+        numof++;
+    }
+
+    saul_coap_init(_auto_sensors, numof);
+    if (numof) {
+        _auto_listener.resources = _auto_resources;
+        _auto_listener.resources_len = numof;
+        _auto_listener.link_encoder = _auto_link_encoder;
+        gcoap_register_listener(&_auto_listener);
+#ifdef MODULE_COAP_SAUL_OBSERVE
+        saul_coap_observe_init(&_auto_listener);
+#endif
+    }
+    if (sensors) {
+        *sensors = _auto_sensors;
+    }
+    return numof;
+}
+#endif
+
+#ifdef MODULE_COAP_SAUL_LATENCY
+/**
+ * @brief   Longest line of saul_coap_latency_cmd()
+ */
+#define COAP_SAUL_LATENCY_LINE_LEN  (48U + CONFIG_COAP_SAUL_LATENCY_BUCKETS * 14U)
+
+static void _latency_add(saul_coap_sensor_t *sensor, uint32_t us, bool error)
+{
+    unsigned bucket = us < 64 ? 0 : bitarithm_msb(us) - 5;
+
+    if (bucket >= CONFIG_COAP_SAUL_LATENCY_BUCKETS) {
+        bucket = CONFIG_COAP_SAUL_LATENCY_BUCKETS - 1;
+    }
+    /* reads race between the sampler, gcoap and report threads */
+    unsigned state = irq_disable();
+    if (sensor->read_hist[bucket] < UINT16_MAX) {
+        sensor->read_hist[bucket]++;
+    }
+    if (us > sensor->read_max) {
+        sensor->read_max = us;
+    }
+    if (error) {
+        sensor->read_errors++;
+    }
+    irq_restore(state);
+}
+
+static int _latency_fmt(const saul_coap_sensor_t *sensor, char *buf,
+                        size_t len)
+{
+    uint16_t hist[CONFIG_COAP_SAUL_LATENCY_BUCKETS];
+    uint32_t reads = 0;
+    uint32_t max;
+    uint32_t errors;
+
+    unsigned state = irq_disable();
+    memcpy(hist, sensor->read_hist, sizeof(hist));
+    max = sensor->read_max;
+    errors = sensor->read_errors;
+    irq_restore(state);
+
+    for (unsigned i = 0; i < ARRAY_SIZE(hist); i++) {
+        reads += hist[i];
+    }
+    int p = snprintf(buf, len, "%s n:%"PRIu32" err:%"PRIu32" max:%"PRIu32,
+                     sensor->name, reads, errors, max);
+    for (unsigned i = 0; i < ARRAY_SIZE(hist) && p >= 0 &&
+         (size_t)p < len; i++) {
+        if (hist[i] == 0) {
+            continue;
+        }
+        if (i == ARRAY_SIZE(hist) - 1) {
+            p += snprintf(buf + p, len - p, " inf:%u", hist[i]);
+        }
+        else {
+            p += snprintf(buf + p, len - p, " %lu:%u", 64UL << i, hist[i]);
+        }
+    }
+    if (p >= 0 && (size_t)p < len) {
+        p += snprintf(buf + p, len - p, "\n");
+    }
+    return (p < 0 || (size_t)p >= len) ? -ENOBUFS : p;
+}
+
+int saul_coap_latency_cmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    char line[COAP_SAUL_LATENCY_LINE_LEN];
+
+    for (unsigned i = 0; i < _sensors_numof; i++) {
+        saul_coap_sensor_t *sensor = &_sensors[i];
+        if (sensor->dev == NULL || sensor->name == NULL) {
+            continue;
+        }
+        if (_latency_fmt(sensor, line, sizeof(line)) > 0) {
+            printf("%s", line);
+        }
+    }
+    return 0;
+}
+
+ssize_t saul_coap_latency_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                                  void *ctx)
+{
+    (void)ctx;
+    char line[COAP_SAUL_LATENCY_LINE_LEN];
+    coap_block_slicer_t slicer;
+
+    coap_block2_init(pdu, &slicer);
+    gcoap_resp_init(pdu, buf, len, COAP_CODE_CONTENT);
+    coap_opt_add_format(pdu, COAP_FORMAT_TEXT);
+    coap_opt_add_block2(pdu, &slicer, 1);
+    ssize_t plen = coap_opt_finish(pdu, COAP_OPT_FINISH_PAYLOAD);
+    uint8_t *pos = pdu->payload;
+
+    for (unsigned i = 0; i < _sensors_numof; i++) {
+        saul_coap_sensor_t *sensor = &_sensors[i];
+        if (sensor->dev == NULL || sensor->name == NULL) {
+            continue;
+        }
+        int p = _latency_fmt(sensor, line, sizeof(line));
+        if (p > 0) {
+            pos += coap_blockwise_put_bytes(&slicer, pos, (uint8_t *)line, p);
+        }
+    }
+    coap_block2_finish(&slicer);
+
+    return plen + (pos - pdu->payload);
+}
+#endif
+
+static int _read_saul_data(phydat_t *data, saul_coap_sensor_t *sensor)
+{
+    /* only reads of the same sensor wait for each other */
+    mutex_lock(&sensor->read_lock);
+    saul_reg_t *dev = sensor->dev;
+    if (dev == NULL) {
+        mutex_unlock(&sensor->read_lock);
+        return -ENODEV;
     }
 
     /* read sensor data*/
-    phydat_t data;
-    int dim = saul_reg_read(saul, &data);
+#ifdef MODULE_COAP_SAUL_LATENCY
+    uint32_t start = ztimer_now(ZTIMER_USEC);
+    int dim = saul_reg_read(dev, data);
+    _latency_add(sensor, ztimer_now(ZTIMER_USEC) - start, dim <= 0);
+#else
+    int dim = saul_reg_read(dev, data);
+#endif
+    mutex_unlock(&sensor->read_lock);
     if (dim <= 0) {
         DEBUG_PUTS("[ERROR] dim <= 0");
-        return -1;
+        return -EIO;
+    }
+    return dim;
+}
+
+#ifdef MODULE_COAP_SAUL_STATS
+/**
+ * @brief   Closes the current window once CONFIG_COAP_SAUL_STATS_WINDOW
+ *          elapsed, it replaces a closed window not taken yet. Must be
+ *          called with _snap_lock held.
+ */
+static void _stats_close(saul_coap_sensor_t *sensor, uint32_t now)
+{
+    if (sensor->stats.count &&
+        now - sensor->stats.start >= CONFIG_COAP_SAUL_STATS_WINDOW) {
+        sensor->stats_closed = sensor->stats;
+        sensor->stats.count = 0;
     }
+}
+
+/**
+ * @brief   Adds a sample to the aggregate of the window, a sample of another
+ *          unit, scale or dimension restarts it. Must be called with
+ *          _snap_lock held.
+ */
+static void _stats_add(saul_coap_stats_t *stats, const phydat_t *data,
+                       int dim, uint32_t now)
+{
+    if (stats->count &&
+        (stats->dim != dim || stats->unit != data->unit ||
+         stats->scale != data->scale)) {
+        stats->count = 0;
+    }
+    if (stats->count == 0) {
+        stats->start = now;
+        stats->dim = dim;
+        stats->unit = data->unit;
+        stats->scale = data->scale;
+    }
+    else if (stats->count == COAP_SAUL_STATS_COUNT_MAX) {
+        return;
+    }
+    stats->count++;
+    for (int i = 0; i < dim; i++) {
+        int32_t x = (int32_t)data->val[i] << COAP_SAUL_STATS_FRAC;
+        if (stats->count == 1) {
+            stats->min[i] = data->val[i];
+            stats->max[i] = data->val[i];
+            stats->mean[i] = x;
+            stats->m2[i] = 0;
+            continue;
+        }
+        if (data->val[i] < stats->min[i]) {
+            stats->min[i] = data->val[i];
+        }
+        if (data->val[i] > stats->max[i]) {
+            stats->max[i] = data->val[i];
+        }
+        /* Welford: M2 += (x - mean_old) * (x - mean_new) */
+        int32_t delta = x - stats->mean[i];
+        /* rounded to nearest, truncation would bias the mean toward 0 */
+        int32_t half = stats->count / 2;
+        stats->mean[i] += (delta + (delta < 0 ? -half : half)) /
+                          stats->count;
+        stats->m2[i] += (int64_t)delta * (x - stats->mean[i]);
+    }
+}
 
+/**
+ * @brief   Aggregates a sample taken by the sampler or for a report, the
+ *          window it belongs to closes on the first sample past its end
+ */
+static void _stats_sample(saul_coap_sensor_t *sensor, const phydat_t *data,
+                          int dim)
+{
+    mutex_lock(&_snap_lock);
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    _stats_close(sensor, now);
+    _stats_add(&sensor->stats, data, dim, now);
+    mutex_unlock(&_snap_lock);
+}
+
+/**
+ * @brief   Moves the latest closed window out, closing the current one if
+ *          it elapsed without a later sample
+ *
+ * @return  true if @p stats holds a closed window
+ */
+static bool _stats_take(saul_coap_sensor_t *sensor, saul_coap_stats_t *stats)
+{
+    bool closed;
+
+    mutex_lock(&_snap_lock);
+    _stats_close(sensor, ztimer_now(ZTIMER_MSEC));
+    closed = sensor->stats_closed.count != 0;
+    if (closed) {
+        *stats = sensor->stats_closed;
+        sensor->stats_closed.count = 0;
+    }
+    mutex_unlock(&_snap_lock);
+    return closed;
+}
+
+static uint32_t _isqrt(uint64_t x)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        }
+        else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+/**
+ * @brief   Converts Q8 values to a phydat at the scale of the samples, with
+ *          one more decimal if @p finer and that fits
+ */
+static void _stats_phydat(phydat_t *out, const int64_t *q8, int dim,
+                          const saul_coap_stats_t *stats, bool finer)
+{
+    bool fine = finer;
+    const int64_t half = 1 << (COAP_SAUL_STATS_FRAC - 1);
+
+    for (int i = 0; fine && i < dim; i++) {
+        int64_t v = (q8[i] * 10 + half) >> COAP_SAUL_STATS_FRAC;
+        fine = fine && v >= PHYDAT_MIN && v <= PHYDAT_MAX;
+    }
+    for (int i = 0; i < dim; i++) {
+        out->val[i] = fine ?
+                      (q8[i] * 10 + half) >> COAP_SAUL_STATS_FRAC :
+                      (q8[i] + half) >> COAP_SAUL_STATS_FRAC;
+    }
+    out->unit = stats->unit;
+    out->scale = fine ? stats->scale - 1 : stats->scale;
+}
+
+typedef struct {
+    phydat_t mean;
+    phydat_t min;
+    phydat_t max;
+    phydat_t sd;
+    phydat_t n;
+} saul_coap_aggregate_t;
+
+static void _stats_aggregate(saul_coap_aggregate_t *agg,
+                             const saul_coap_stats_t *stats)
+{
+    int64_t mean[PHYDAT_DIM];
+    int64_t sd[PHYDAT_DIM];
+
+    for (int i = 0; i < stats->dim; i++) {
+        mean[i] = stats->mean[i];
+        /* sample variance in Q16, its root is Q8 */
+        int64_t var = stats->count > 1 ?
+                      stats->m2[i] / (stats->count - 1) : 0;
+        sd[i] = var > 0 ? _isqrt(var) : 0;
+        agg->min.val[i] = stats->min[i];
+        agg->max.val[i] = stats->max[i];
+    }
+    /* the policy compares means across windows, their scale never moves */
+    _stats_phydat(&agg->mean, mean, stats->dim, stats, false);
+    _stats_phydat(&agg->sd, sd, stats->dim, stats, true);
+    agg->min.unit = agg->max.unit = stats->unit;
+    agg->min.scale = agg->max.scale = stats->scale;
+    agg->n.val[0] = stats->count > PHYDAT_MAX ? PHYDAT_MAX : stats->count;
+    agg->n.unit = UNIT_NONE;
+    agg->n.scale = 0;
+}
+#endif
+
+/**
+ * @brief   Stores a new sample in the back buffer and makes it the latest
+ *
+ * The sequence number is bumped once the front moved: from then on the
+ * previous front is the next back buffer, a reader still copying it
+ * retries.
+ */
+static void _snap_write(saul_coap_sensor_t *sensor, const phydat_t *data,
+                        int dim)
+{
+    /* serializes writers when there is no sampler thread */
+    mutex_lock(&_snap_lock);
+    uint8_t back = sensor->front ^ 1;
+    sensor->snap[back].data = *data;
+    sensor->snap[back].time = ztimer_now(ZTIMER_MSEC);
+    sensor->snap[back].dim = dim;
+    __atomic_store_n(&sensor->front, back, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&sensor->seq, 1, __ATOMIC_RELEASE);
+    mutex_unlock(&_snap_lock);
+}
+
+/**
+ * @brief   Copies the latest sample, lock free
+ *
+ * @return  its dimensions, 0 if none was taken yet
+ */
+static int _snap_read(const saul_coap_sensor_t *sensor, phydat_t *data,
+                      uint32_t *time)
+{
+    uint16_t seq;
+    int dim;
+
+    do {
+        seq = __atomic_load_n(&sensor->seq, __ATOMIC_ACQUIRE);
+        const saul_coap_snapshot_t *front =
+            &sensor->snap[__atomic_load_n(&sensor->front, __ATOMIC_ACQUIRE)];
+        dim = front->dim;
+        *data = front->data;
+        *time = front->time;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&sensor->seq, __ATOMIC_RELAXED) != seq);
+    return dim;
+}
+
+/**
+ * @brief   Copies the cached sample of a sensor if @p cached and it is
+ *          younger than the sensor max age, reads the sensor otherwise.
+ *          Fresh reads refresh the cache.
+ *
+ * With the sampler thread the latest snapshot is always copied and the
+ * sensor is never read from here.
+ *
+ * @param[out] age  Age of the returned sample in ms
+ */
+static int _saul_sample(saul_coap_sensor_t *sensor, phydat_t *data,
+                        bool cached, uint32_t *age)
+{
+    uint32_t time;
+
+    if (IS_USED(MODULE_COAP_SAUL_SAMPLER)) {
+        int dim = _snap_read(sensor, data, &time);
+        *age = ztimer_now(ZTIMER_MSEC) - time;
+        return dim ? dim : -EAGAIN;
+    }
+    if (cached && sensor->max_age) {
+        int dim = _snap_read(sensor, data, &time);
+        *age = ztimer_now(ZTIMER_MSEC) - time;
+        if (dim && *age < sensor->max_age) {
+            return dim;
+        }
+    }
+
+    int dim = _read_saul_data(data, sensor);
+    *age = 0;
+    if (dim > 0) {
+        _snap_write(sensor, data, dim);
+    }
+    return dim;
+}
+
+/**
+ * @brief   Applies the sensor report policy to a new reading
+ *
+ * @return  true if the reading must be reported, it is then recorded as
+ *          the last report
+ */
+static bool _saul_report_due(saul_coap_sensor_t *sensor, const phydat_t *data,
+                             int dim)
+{
+    const saul_coap_policy_t *policy = sensor->policy;
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    uint32_t elapsed = now - sensor->reported_at;
+    bool due;
+
+    if (policy == NULL || sensor->reported_dim == 0) {
+        due = true;
+    }
+    else if (elapsed < policy->min_interval) {
+        due = false;
+    }
+    else if (sensor->reported_dim != dim ||
+             sensor->reported.unit != data->unit ||
+             sensor->reported.scale != data->scale) {
+        due = true;
+    }
+    else {
+        due = policy->heartbeat && elapsed >= policy->heartbeat;
+        for (int i = 0; !due && i < dim; i++) {
+            int32_t last = sensor->reported.val[i];
+            uint32_t diff = abs(data->val[i] - last);
+            due = (policy->abs_delta && diff >= policy->abs_delta) ||
+                  (policy->rel_delta && diff &&
+                   diff * 1000 >= policy->rel_delta * (uint32_t)abs(last));
+        }
+    }
+
+    if (!due) {
+        sensor->suppressed++;
+        return false;
+    }
+    sensor->sent++;
+    sensor->reported = *data;
+    sensor->reported_dim = dim;
+    sensor->reported_at = now;
+    return true;
+}
+
+int saul_coap_report_cmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    for (unsigned i = 0; i < _sensors_numof; i++) {
+        saul_coap_sensor_t *sensor = &_sensors[i];
+        if (sensor->dev == NULL || sensor->name == NULL) {
+            continue;
+        }
+        printf("%s sent:%"PRIu32" suppressed:%"PRIu32"\n", sensor->name,
+               sensor->sent, sensor->suppressed);
+    }
+    return 0;
+}
+
+/**
+ * @brief   Formats the @p dim values of a sample as "v0, v1, v2 unit",
+ *          prefixed with "name: " if @p name is given
+ */
+static ssize_t _saul_data_str(char *buf, size_t len, const char *name,
+                              const phydat_t *data, int dim)
+{
     /* format data string */
     char data_str[16];
     char scale_prefix;
-    size_t len;
+    size_t data_len;
     int8_t scale;
     /* add unit prefix for some units */
-    switch (data.unit) {
+    switch (data->unit) {
         case UNIT_UNDEF:
         case UNIT_NONE:
         case UNIT_M2:
@@ -65,86 +800,928 @@ static ssize_t _read_saul_data_str(uint8_t *buf, uint8_t type, uint8_t subtype)
         case UNIT_DBM:
             /* no string conversion */
             scale_prefix = '\0';
-            scale = data.scale;
+            scale = data->scale;
             break;
         default:
             scale = 0;
-            scale_prefix = phydat_prefix_from_scale(data.scale);
+            scale_prefix = phydat_prefix_from_scale(data->scale);
     }
-    len = fmt_s16_dfp(data_str, data.val[0], scale);
-    data_str[len] = '\0';
-    size_t p;
-    if (scale_prefix) {
-        p = sprintf((char*)buf, "%s %c%s", data_str,
-                    scale_prefix, phydat_unit_to_str(data.unit));
+    int p = 0;
+    if (name) {
+        p = snprintf(buf, len, "%s: ", name);
     }
-    else {
-        p = sprintf((char*)buf, "%s %s", data_str,
-                    phydat_unit_to_str(data.unit));
+    for (int i = 0; i < dim && p >= 0 && (size_t)p < len; i++) {
+        data_len = fmt_s16_dfp(data_str, data->val[i], scale);
+        data_str[data_len] = '\0';
+        p += snprintf(buf + p, len - p, i ? ", %s" : "%s", data_str);
+    }
+    if (p >= 0 && (size_t)p < len) {
+        if (scale_prefix) {
+            p += snprintf(buf + p, len - p, " %c%s", scale_prefix,
+                          phydat_unit_to_str(data->unit));
+        }
+        else {
+            p += snprintf(buf + p, len - p, " %s",
+                          phydat_unit_to_str(data->unit));
+        }
+    }
+    if (p < 0 || (size_t)p >= len) {
+        return -ENOBUFS;
     }
-    *(buf + p) = '\0';
-    DEBUG("%s: %s\n", __FUNCTION__, buf);
+    DEBUG("%s: %s\n", __func__, buf);
 
     return p;
 }
 
+#ifdef MODULE_COAP_SAUL_SENML
+typedef struct {
+    uint8_t unit;
+    int8_t scale;           /**< added to the phydat scale */
+    uint16_t mul;           /**< factor applied to the value, 0 for none */
+    const char *str;
+} saul_coap_senml_unit_t;
+
+/* phydat units with a SenML equivalent, RFC 8428 and RFC 8798, converted
+   as mul * 10^scale, units without one are left out of the records */
+static const saul_coap_senml_unit_t _senml_units[] = {
+    { UNIT_TEMP_C, 0, 0, "Cel" },
+    { UNIT_TEMP_K, 0, 0, "K" },
+    { UNIT_LUX, 0, 0, "lx" },
+    { UNIT_M, 0, 0, "m" },
+    { UNIT_M2, 0, 0, "m2" },
+    { UNIT_M3, 0, 0, "m3" },
+    { UNIT_G, -3, 9807, "m/s2" },        /* 9.807 m/s2 per g */
+    { UNIT_DPS, -6, 17453, "rad/s" },    /* pi / 180 rad/s per deg/s */
+    { UNIT_GR, 0, 0, "g" },
+    { UNIT_A, 0, 0, "A" },
+    { UNIT_V, 0, 0, "V" },
+    { UNIT_GS, -4, 0, "T" },
+    { UNIT_DBM, 0, 0, "dBm" },
+    { UNIT_COULOMB, 0, 0, "C" },
+    { UNIT_F, 0, 0, "F" },
+    { UNIT_OHM, 0, 0, "Ohm" },
+    { UNIT_BAR, 5, 0, "Pa" },
+    { UNIT_PA, 0, 0, "Pa" },
+    { UNIT_CD, 0, 0, "cd" },
+    { UNIT_PERCENT, 0, 0, "%" },
+    { UNIT_PERMILL, -3, 0, "/" },
+    { UNIT_PPM, 0, 0, "ppm" },
+    { UNIT_GPM3, -3, 0, "kg/m3" },
+};
+
+/**
+ * @brief   Encodes one SenML record per dimension of a sample, suffixed
+ *          with _x, _y and _z when there is more than one
+ */
+static ssize_t _saul_data_senml(uint8_t *buf, size_t len, const char *name,
+                                const phydat_t *data, int dim)
+{
+    nanocbor_encoder_t enc;
+    const char *unit = NULL;
+    int8_t scale = data->scale;
+    int32_t mul = 1;
+
+    for (unsigned i = 0; i < ARRAY_SIZE(_senml_units); i++) {
+        if (_senml_units[i].unit == data->unit) {
+            unit = _senml_units[i].str;
+            scale += _senml_units[i].scale;
+            if (_senml_units[i].mul) {
+                mul = _senml_units[i].mul;
+            }
+            break;
+        }
+    }
+
+    nanocbor_encoder_init(&enc, buf, len);
+    for (int i = 0; i < dim; i++) {
+        char dim_name[24];
+        snprintf(dim_name, sizeof(dim_name), dim > 1 ? "%s_%c" : "%s",
+                 name ? name : "", 'x' + i);
+        nanocbor_fmt_map(&enc, unit ? 3 : 2);
+        nanocbor_fmt_int(&enc, SENML_LABEL_NAME);
+        nanocbor_put_tstr(&enc, dim_name);
+        if (unit) {
+            nanocbor_fmt_int(&enc, SENML_LABEL_UNIT);
+            nanocbor_put_tstr(&enc, unit);
+        }
+        nanocbor_fmt_int(&enc, SENML_LABEL_VALUE);
+        /* integer value, or a decimal fraction keeping the phydat scale,
+           an int16_t times a 16 bit factor always fits 32 bits */
+        int32_t val = data->val[i] * mul;
+        if (scale == 0) {
+            nanocbor_fmt_int(&enc, val);
+        }
+        else {
+            nanocbor_fmt_decimal_frac(&enc, scale, val);
+        }
+    }
+
+    size_t enc_len = nanocbor_encoded_len(&enc);
+    return enc_len > len ? -ENOBUFS : (ssize_t)enc_len;
+}
+#endif
+
+/**
+ * @brief   Encodes the records of a reading in @p format, the name is
+ *          always part of SenML records but optional for text
+ */
+static ssize_t _saul_encode_record(uint8_t *buf, size_t len, uint16_t format,
+                                   const char *name, const phydat_t *data,
+                                   int dim)
+{
+    switch (format) {
+        case COAP_FORMAT_TEXT:
+            return _saul_data_str((char *)buf, len, name, data, dim);
+#ifdef MODULE_COAP_SAUL_SENML
+        case COAP_FORMAT_SENML_CBOR:
+            return _saul_data_senml(buf, len, name, data, dim);
+#endif
+        default:
+            return -ENOTSUP;
+    }
+}
+
+/**
+ * @brief   Encodes a reading in @p format as a complete payload
+ */
+static ssize_t _saul_encode(uint8_t *buf, size_t len, uint16_t format,
+                            const char *name, const phydat_t *data, int dim)
+{
+    switch (format) {
+        case COAP_FORMAT_TEXT:
+            return _saul_data_str((char *)buf, len, name, data, dim);
+#ifdef MODULE_COAP_SAUL_SENML
+        case COAP_FORMAT_SENML_CBOR: {
+            if (len < 1) {
+                return -ENOBUFS;
+            }
+            buf[0] = SENML_PACK_HDR(dim);
+            ssize_t res = _saul_data_senml(buf + 1, len - 1, name, data, dim);
+            return res < 0 ? res : res + 1;
+        }
+#endif
+        default:
+            return -ENOTSUP;
+    }
+}
+
+#ifdef MODULE_COAP_SAUL_OBSERVE
+/* notifications are assembled here, one at a time, the lock also orders
+   the rate limit checks of the sampler and of the reports */
+static uint8_t _notify_buf[CONFIG_GCOAP_PDU_BUF_SIZE];
+static mutex_t _notify_lock = MUTEX_INIT;
+
+void saul_coap_observe_init(const gcoap_listener_t *listener)
+{
+    for (; listener; listener = listener->next) {
+        for (size_t i = 0; i < listener->resources_len; i++) {
+            const coap_resource_t *resource = &listener->resources[i];
+            if (resource->handler == saul_coap_handler && resource->context) {
+                saul_coap_sensor_t *sensor = resource->context;
+                sensor->resource = resource;
+                sensor->obs_format = COAP_FORMAT_TEXT;
+                /* first notification is not rate limited */
+                sensor->notified_at = ztimer_now(ZTIMER_MSEC) -
+                                      CONFIG_COAP_SAUL_OBS_MIN_INTERVAL;
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Notifies the observers of a sensor of a new sample in the format
+ *          they registered with, at most once every
+ *          CONFIG_COAP_SAUL_OBS_MIN_INTERVAL
+ */
+static void _saul_notify(saul_coap_sensor_t *sensor, const phydat_t *data,
+                         int dim)
+{
+    if (sensor->resource == NULL) {
+        return;
+    }
+
+    mutex_lock(&_notify_lock);
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    if (now - sensor->notified_at < CONFIG_COAP_SAUL_OBS_MIN_INTERVAL) {
+        goto out;
+    }
+    coap_pkt_t pdu;
+    /* no-op unless a client registered, gcoap bounds their number */
+    if (gcoap_obs_init(&pdu, _notify_buf, sizeof(_notify_buf),
+                       sensor->resource) != GCOAP_OBS_INIT_OK) {
+        goto out;
+    }
+    uint16_t format = sensor->obs_format;
+    coap_opt_add_format(&pdu, format);
+    coap_opt_add_uint(&pdu, COAP_OPT_MAX_AGE, sensor->max_age / MS_PER_SEC);
+    ssize_t len = coap_opt_finish(&pdu, COAP_OPT_FINISH_PAYLOAD);
+    /* same payload as a GET with that Accept */
+    ssize_t payload_len = _saul_encode(pdu.payload, pdu.payload_len, format,
+                                       format == COAP_FORMAT_TEXT ? NULL :
+                                       sensor->name, data, dim);
+    if (payload_len <= 0) {
+        goto out;
+    }
+    if (gcoap_obs_send(_notify_buf, len + payload_len, sensor->resource) > 0) {
+        sensor->notified_at = now;
+        sensor->notified++;
+    }
+out:
+    mutex_unlock(&_notify_lock);
+}
+#else
+static inline void _saul_notify(saul_coap_sensor_t *sensor,
+                                const phydat_t *data, int dim)
+{
+    (void)sensor;
+    (void)data;
+    (void)dim;
+}
+#endif
+
+#ifdef MODULE_COAP_SAUL_SAMPLER
+static char _sampler_stack[CONFIG_COAP_SAUL_SAMPLER_STACKSIZE];
+
+static void *_sampler_thread(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        uint32_t now = ztimer_now(ZTIMER_MSEC);
+        /* checks for rebound sensors meanwhile */
+        uint32_t sleep = CONFIG_COAP_SAUL_MAX_AGE ? CONFIG_COAP_SAUL_MAX_AGE :
+                         MS_PER_SEC;
+
+        for (unsigned i = 0; i < _sensors_numof; i++) {
+            saul_coap_sensor_t *sensor = &_sensors[i];
+            uint32_t period = sensor->max_age ? sensor->max_age :
+                              CONFIG_COAP_SAUL_MAX_AGE;
+            /* a max age of 0 samples as fast as allowed, without spinning */
+            if (period == 0) {
+                period = 1;
+            }
+            if (sensor->dev == NULL) {
+                continue;
+            }
+            if ((int32_t)(sensor->next_sample - now) <= 0) {
+                phydat_t data;
+                int dim = _read_saul_data(&data, sensor);
+                if (dim > 0) {
+                    _snap_write(sensor, &data, dim);
+#ifdef MODULE_COAP_SAUL_STATS
+                    _stats_sample(sensor, &data, dim);
+#endif
+                    _saul_notify(sensor, &data, dim);
+                }
+                sensor->next_sample += period;
+                if ((int32_t)(sensor->next_sample - now) <= 0) {
+                    sensor->next_sample = now + period;
+                }
+            }
+            uint32_t left = sensor->next_sample - now;
+            if (left < sleep) {
+                sleep = left;
+            }
+        }
+        ztimer_sleep(ZTIMER_MSEC, sleep);
+    }
+    return NULL;
+}
+
+static void _sampler_init(void)
+{
+    static kernel_pid_t pid = KERNEL_PID_UNDEF;
+
+    if (pid != KERNEL_PID_UNDEF) {
+        return;
+    }
+    pid = thread_create(_sampler_stack, sizeof(_sampler_stack),
+                        CONFIG_COAP_SAUL_SAMPLER_PRIO, THREAD_CREATE_STACKTEST,
+                        _sampler_thread, NULL, "saul sampler");
+}
+#endif
+
+static bool _saul_format_supported(uint32_t format)
+{
+    return format == COAP_FORMAT_TEXT ||
+           (IS_USED(MODULE_COAP_SAUL_SENML) &&
+            format == COAP_FORMAT_SENML_CBOR);
+}
+
 ssize_t saul_coap_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len, void *ctx)
 {
-    uint8_t type = *((uint8_t*) ctx);
-    uint8_t subtype = *((uint8_t*) ++ctx);
-    uint8_t data_str[16];
-    DEBUG("%s: type,subtype %02x, %02x\n", __FUNCTION__, type, subtype);
-    size_t data_len = _read_saul_data_str(data_str, type, subtype);
-    if (data_len <= 0 ) {
-        DEBUG_PUTS("[ERROR] data_len <= 0");
-        return -1;
+    saul_coap_sensor_t *sensor = ctx;
+    uint32_t format;
+    uint32_t age;
+    DEBUG("%s: type,subtype %02x, %02x\n", __func__, sensor->type,
+          sensor->subtype);
+
+    /* answer right away when the sensor is not on this board */
+    if (sensor->dev == NULL) {
+        return gcoap_response(pdu, buf, len, COAP_CODE_PATH_NOT_FOUND);
+    }
+
+    /* text unless the client asks for something else */
+    if (coap_opt_get_uint(pdu, COAP_OPT_ACCEPT, &format) != 0) {
+        format = COAP_FORMAT_TEXT;
+    }
+    if (!_saul_format_supported(format)) {
+        return gcoap_response(pdu, buf, len, COAP_CODE_NOT_ACCEPTABLE);
     }
+    phydat_t data;
+    int dim = _saul_sample(sensor, &data, true, &age);
+    if (dim == -EAGAIN) {
+        return gcoap_response(pdu, buf, len, COAP_CODE_SERVICE_UNAVAILABLE);
+    }
+    else if (dim < 0) {
+        return gcoap_response(pdu, buf, len, COAP_CODE_INTERNAL_SERVER_ERROR);
+    }
+    uint8_t payload[COAP_SAUL_PAYLOAD_LEN];
+    /* text GET responses carry the bare value */
+    ssize_t payload_len = _saul_encode(payload, sizeof(payload), format,
+                                       format == COAP_FORMAT_TEXT ? NULL :
+                                       sensor->name, &data, dim);
+    if (payload_len <= 0) {
+        DEBUG_PUTS("[ERROR] payload_len <= 0");
+        return gcoap_response(pdu, buf, len, COAP_CODE_INTERNAL_SERVER_ERROR);
+    }
+#ifdef MODULE_COAP_SAUL_OBSERVE
+    /* gcoap keeps a single observer per resource and clears the Observe
+       option of a registration it refused, so the format only follows the
+       request that became or refreshed the observer, answered with 2.05 */
+    if (coap_get_observe(pdu) == COAP_OBS_REGISTER) {
+        sensor->obs_format = format;
+    }
+#endif
     /* Prepare COAP response */
-    return _saul_gcoap_response(pdu, buf, len, ctx, data_str, data_len);
+    /* clients may reuse the response while the sample is fresh */
+    uint32_t max_age = sensor->max_age > age ?
+                       (sensor->max_age - age) / MS_PER_SEC : 0;
+    return _saul_gcoap_response(pdu, buf, len, format, max_age, payload,
+                                payload_len);
 }
 
-void saul_coap_send(void *args)
+#ifdef MODULE_COAP_SAUL_LOG
+/**
+ * @brief   Width of a line of the report log, lines are padded to it so
+ *          that a block starts at a computed entry
+ */
+#define COAP_SAUL_LOG_LINE_LEN      (80U)
+
+/**
+ * @brief   Longest query string of a log request
+ */
+#define COAP_SAUL_LOG_QUERY_LEN     (72U)
+
+/**
+ * @brief   A logged report
+ */
+typedef struct {
+    uint32_t seq;           /**< sequence number, starts at 1 */
+    uint32_t time;          /**< ZTIMER_MSEC time of the report */
+    int16_t val[PHYDAT_DIM];
+    uint8_t name;           /**< index in _names */
+    uint8_t dim;
+    uint8_t unit;
+    int8_t scale;
+} saul_coap_log_entry_t;
+
+static mutex_t _log_lock = MUTEX_INIT;
+/* sequence number of the next entry */
+static uint32_t _log_next = 1;
+
+#ifdef MODULE_COAP_SAUL_LOG_MTD
+static mtd_dev_t *_log_mtd;
+static uint32_t _log_addr;
+static uint32_t _log_numof;
+static uint32_t _log_per_page;
+static uint32_t _log_per_sector;
+
+/* entries never cross a page */
+static uint32_t _log_slot_addr(uint32_t slot)
+{
+    return _log_addr + (slot / _log_per_page) * _log_mtd->page_size +
+           (slot % _log_per_page) * sizeof(saul_coap_log_entry_t);
+}
+
+int saul_coap_log_mtd_init(mtd_dev_t *mtd, uint32_t sector, uint32_t sectors)
+{
+    if (sectors < 2 || sector + sectors > mtd->sector_count ||
+        mtd->page_size < sizeof(saul_coap_log_entry_t)) {
+        return -EINVAL;
+    }
+    _log_mtd = mtd;
+    _log_addr = sector * mtd->pages_per_sector * mtd->page_size;
+    _log_per_page = mtd->page_size / sizeof(saul_coap_log_entry_t);
+    _log_per_sector = _log_per_page * mtd->pages_per_sector;
+    _log_numof = _log_per_sector * sectors;
+
+    /* resume after the newest entry, erased slots read as all ones */
+    uint32_t last = 0;
+    for (uint32_t slot = 0; slot < _log_numof; slot++) {
+        uint32_t seq;
+        if (mtd_read(mtd, &seq, _log_slot_addr(slot), sizeof(seq)) == 0 &&
+            seq != UINT32_MAX && seq % _log_numof == slot && seq > last) {
+            last = seq;
+        }
+    }
+    _log_next = last + 1;
+    DEBUG("[DEBUG] saul log: %"PRIu32" entries, next %"PRIu32"\n",
+          _log_numof, _log_next);
+    return 0;
+}
+
+static void _log_write(const saul_coap_log_entry_t *entry)
+{
+    if (_log_mtd == NULL) {
+        return;
+    }
+    uint32_t slot = entry->seq % _log_numof;
+    if (slot % _log_per_sector == 0) {
+        mtd_erase(_log_mtd, _log_slot_addr(slot),
+                  _log_mtd->pages_per_sector * _log_mtd->page_size);
+    }
+    mtd_write(_log_mtd, entry, _log_slot_addr(slot), sizeof(*entry));
+}
+
+static int _log_read(uint32_t seq, saul_coap_log_entry_t *entry)
+{
+    if (_log_mtd == NULL ||
+        mtd_read(_log_mtd, entry, _log_slot_addr(seq % _log_numof),
+                 sizeof(*entry)) != 0) {
+        return -EIO;
+    }
+    return entry->seq == seq ? 0 : -ENOENT;
+}
+
+/**
+ * @brief   Oldest entry left once @p last was written, the rest of the
+ *          sector of @p last was erased
+ */
+static uint32_t _log_oldest(uint32_t last)
+{
+    if (_log_mtd == NULL) {
+        return 1;
+    }
+    uint32_t kept = _log_numof - _log_per_sector +
+                    (last % _log_numof) % _log_per_sector + 1;
+    return last + 1 > kept ? last + 1 - kept : 1;
+}
+
+/* sequence numbers carry on across reboots */
+static inline uint32_t _log_epoch(void)
 {
+    return 0;
+}
+#else
+static saul_coap_log_entry_t _log[CONFIG_COAP_SAUL_LOG_NUMOF];
+#define _log_numof  CONFIG_COAP_SAUL_LOG_NUMOF
+
+static void _log_write(const saul_coap_log_entry_t *entry)
+{
+    _log[entry->seq % _log_numof] = *entry;
+}
+
+static int _log_read(uint32_t seq, saul_coap_log_entry_t *entry)
+{
+    *entry = _log[seq % _log_numof];
+    return entry->seq == seq ? 0 : -ENOENT;
+}
 
-    uint8_t type = *((uint8_t*) args);
-    uint8_t subtype = *((uint8_t*) ++args);
-    uint8_t data_str[16];
-    size_t data_len = _read_saul_data_str(data_str, type, subtype);
-    if (data_len == 0 ) {
+static uint32_t _log_oldest(uint32_t last)
+{
+    return last + 1 > _log_numof ? last + 1 - _log_numof : 1;
+}
+
+static uint32_t _log_boot;
+
+/**
+ * @brief   Random epoch of this boot, sequence numbers restart at 1 on
+ *          every boot. Must be called with _log_lock held.
+ */
+static uint32_t _log_epoch(void)
+{
+    if (_log_boot == 0) {
+        _log_boot = random_uint32() | 1;
+    }
+    return _log_boot;
+}
+#endif
+
+/**
+ * @brief   Appends a report to the log
+ */
+static void _log_append(const saul_coap_sensor_t *sensor,
+                        const phydat_t *data, int dim)
+{
+    const saul_coap_name_t *name = _saul_find_name(sensor->type,
+                                                   sensor->subtype);
+    saul_coap_log_entry_t entry = {
+        .time = ztimer_now(ZTIMER_MSEC),
+        .dim = dim,
+        .unit = data->unit,
+        .scale = data->scale,
+    };
+
+    if (name == NULL) {
         return;
     }
-    uint8_t response[32];
-    if (type == SAUL_SENSE_TEMP) {
-        sprintf((char*)&response, "%s: %s", "temperature", data_str);
+    entry.name = name - _names;
+    memcpy(entry.val, data->val, sizeof(entry.val));
+    mutex_lock(&_log_lock);
+    entry.seq = _log_next++;
+    _log_write(&entry);
+    mutex_unlock(&_log_lock);
+}
+
+/**
+ * @brief   Formats @p entry padded to COAP_SAUL_LOG_LINE_LEN, values that do
+ *          not fit are left out
+ */
+static void _log_fmt(const saul_coap_log_entry_t *entry,
+                     char buf[COAP_SAUL_LOG_LINE_LEN])
+{
+    const size_t len = COAP_SAUL_LOG_LINE_LEN;
+    phydat_t data;
+
+    memcpy(data.val, entry->val, sizeof(data.val));
+    data.unit = entry->unit;
+    data.scale = entry->scale;
+    int p = snprintf(buf, len, "%"PRIu32" %"PRIu32" ", entry->seq,
+                     entry->time);
+    ssize_t res = _saul_data_str(buf + p, len - 1 - p,
+                                 _names[entry->name].name, &data, entry->dim);
+    if (res >= 0 && (size_t)(p + res) < len - 1) {
+        p += res;
     }
-    else if (type == SAUL_SENSE_PRESS) {
-        sprintf((char*)&response, "%s: %s", "pressure", data_str);
+    memset(buf + p, ' ', len - 1 - p);
+    buf[len - 1] = '\n';
+}
+
+/**
+ * @brief   Reads the value of @p key from a query string
+ *
+ * @return  true if @p key is present
+ */
+static bool _log_query(const char *query, const char *key, int base,
+                       uint32_t *val)
+{
+    const char *arg = strstr(query, key);
+    if (arg == NULL) {
+        return false;
     }
-    else if (type == SAUL_SENSE_HUM) {
-        sprintf((char*)&response, "%s: %s", "humidity", data_str);
+    *val = strtoul(arg + strlen(key), NULL, base);
+    return true;
+}
+
+ssize_t saul_coap_log_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                              void *ctx)
+{
+    (void)ctx;
+    char query[COAP_SAUL_LOG_QUERY_LEN];
+    char line[COAP_SAUL_LOG_LINE_LEN];
+    coap_block_slicer_t slicer;
+    uint32_t since = 0;
+    uint32_t until = 0;
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    uint32_t boot = 0;
+    bool pinned = false;
+    bool other_boot = false;
+
+    mutex_lock(&_log_lock);
+    uint32_t next = _log_next;
+    uint32_t epoch = _log_epoch();
+    mutex_unlock(&_log_lock);
+
+    /* options are read before the response overwrites them */
+    ssize_t query_len = coap_opt_get_string(pdu, COAP_OPT_URI_QUERY,
+                                            (uint8_t *)query, sizeof(query),
+                                            '&');
+    if (query_len > 0) {
+        _log_query(query, "&since=", 10, &since);
+        pinned = _log_query(query, "&until=", 10, &until);
+        _log_query(query, "&now=", 10, &now);
+        other_boot = _log_query(query, "&boot=", 16, &boot) && boot != epoch;
     }
-    else if (type == SAUL_SENSE_LIGHT) {
-        sprintf((char*)&response, "%s: %s", "illuminance", data_str);
+    /* the range the first block was built from is gone, start over */
+    if (pinned && (other_boot || until >= next)) {
+        return gcoap_response(pdu, buf, len, COAP_CODE_PRECONDITION_FAILED);
     }
-    else if (type == SAUL_SENSE_CO2) {
-        sprintf((char*)&response, "%s: %s", "eco2", data_str);
+    /* the node restarted without persistent log, send it all */
+    if (other_boot || since >= next) {
+        since = 0;
     }
-    else if (type == SAUL_SENSE_TVOC) {
-        sprintf((char*)&response, "%s: %s", "tvoc", data_str);
+    if (!pinned) {
+        until = next - 1;
+    }
+    uint32_t oldest = _log_oldest(until);
+    uint32_t first = oldest > since ? oldest : since + 1;
+
+    coap_block2_init(pdu, &slicer);
+    gcoap_resp_init(pdu, buf, len, COAP_CODE_CONTENT);
+    coap_opt_add_format(pdu, COAP_FORMAT_TEXT);
+    coap_opt_add_block2(pdu, &slicer, 1);
+    ssize_t plen = coap_opt_finish(pdu, COAP_OPT_FINISH_PAYLOAD);
+    uint8_t *pos = pdu->payload;
+
+    /* fixed width, and the same in every block of a pinned range */
+    int p = snprintf(line, sizeof(line),
+                     "boot:%08"PRIx32" oldest:%010"PRIu32" until:%010"PRIu32
+                     " now:%010"PRIu32"\n", epoch, oldest, until, now);
+    pos += coap_blockwise_put_bytes(&slicer, pos, (uint8_t *)line, p);
+
+    /* lines have a fixed width, skip straight to the first entry of the
+       requested block instead of formatting the ones before it */
+    uint32_t seq = first;
+    if (slicer.start > slicer.cur && first <= until) {
+        uint32_t skip = (slicer.start - slicer.cur) / COAP_SAUL_LOG_LINE_LEN;
+        if (skip > until - first + 1) {
+            skip = until - first + 1;
+        }
+        seq += skip;
+        slicer.cur += skip * COAP_SAUL_LOG_LINE_LEN;
     }
-    else if (type == SAUL_SENSE_TEMP) {
-        sprintf((char*)&response, "%s: %s", "temperature", data_str);
+
+    /* stop formatting once past the requested block */
+    for (; seq <= until && slicer.cur <= slicer.end; seq++) {
+        saul_coap_log_entry_t entry;
+        /* appends only wait for the copy of one entry */
+        mutex_lock(&_log_lock);
+        int res = _log_read(seq, &entry);
+        mutex_unlock(&_log_lock);
+        if (res == -ENOENT) {
+            /* overwritten, the offsets of the next entries moved */
+            return gcoap_response(pdu, buf, len,
+                                  COAP_CODE_PRECONDITION_FAILED);
+        }
+        else if (res != 0) {
+            return gcoap_response(pdu, buf, len,
+                                  COAP_CODE_INTERNAL_SERVER_ERROR);
+        }
+        _log_fmt(&entry, line);
+        pos += coap_blockwise_put_bytes(&slicer, pos, (uint8_t *)line,
+                                        sizeof(line));
     }
-    else if (type == SAUL_SENSE_PM) {
-        if (subtype == SAUL_SENSE_PM_1) {
-            sprintf((char*)&response, "%s: %s", "pm1", data_str);
+    coap_block2_finish(&slicer);
+
+    return plen + (pos - pdu->payload);
+}
+#else
+static inline void _log_append(const saul_coap_sensor_t *sensor,
+                               const phydat_t *data, int dim)
+{
+    (void)sensor;
+    (void)data;
+    (void)dim;
+}
+#endif
+
+#ifdef MODULE_COAP_SAUL_STATS
+/**
+ * @brief   Encodes the records of a window aggregate in @p format, text
+ *          records are separated by new lines
+ *
+ * @param[out] records  number of records encoded
+ */
+static ssize_t _saul_encode_stats(uint8_t *buf, size_t len, uint16_t format,
+                                  const char *name,
+                                  const saul_coap_stats_t *stats,
+                                  unsigned *records)
+{
+    saul_coap_aggregate_t agg;
+    const struct {
+        const char *suffix;
+        const phydat_t *data;
+        int dim;
+    } fields[] = {
+        { "mean", &agg.mean, stats->dim },
+        { "min", &agg.min, stats->dim },
+        { "max", &agg.max, stats->dim },
+        { "sd", &agg.sd, stats->dim },
+        { "n", &agg.n, 1 },
+    };
+    size_t pos = 0;
+
+    _stats_aggregate(&agg, stats);
+    *records = 0;
+    for (unsigned i = 0; i < ARRAY_SIZE(fields); i++) {
+        char field_name[24];
+        snprintf(field_name, sizeof(field_name), "%s_%s", name,
+                 fields[i].suffix);
+        if (format == COAP_FORMAT_TEXT && pos) {
+            if (pos >= len) {
+                return -ENOBUFS;
+            }
+            buf[pos++] = '\n';
+        }
+        ssize_t res = _saul_encode_record(buf + pos, len - pos, format,
+                                          field_name, fields[i].data,
+                                          fields[i].dim);
+        if (res < 0) {
+            return res;
+        }
+        pos += res;
+        *records += format == COAP_FORMAT_TEXT ? 1 : fields[i].dim;
+    }
+    return pos;
+}
+#endif
+
+/**
+ * @brief   Takes a reading of @p sensor and encodes the records to report
+ *          in CONFIG_COAP_SAUL_SEND_FORMAT, without SenML pack header
+ *
+ * @param[out] records  number of records encoded
+ *
+ * @return  length of the records, 0 if there is nothing to report
+ */
+static ssize_t _saul_report(saul_coap_sensor_t *sensor, uint8_t *buf,
+                            size_t len, unsigned *records)
+{
+    const char *name = sensor->name;
+    phydat_t data;
+    uint32_t age;
+
+    if (name == NULL) {
+        return 0;
+    }
+    int dim = _saul_sample(sensor, &data, false, &age);
+    if (dim <= 0) {
+        return 0;
+    }
+    if (!IS_USED(MODULE_COAP_SAUL_SAMPLER)) {
+        _saul_notify(sensor, &data, dim);
+    }
+#ifdef MODULE_COAP_SAUL_STATS
+    /* GET reads stay out of the windows, they would bias them towards the
+       times clients poll */
+    if (!IS_USED(MODULE_COAP_SAUL_SAMPLER)) {
+        _stats_sample(sensor, &data, dim);
+    }
+    saul_coap_stats_t stats;
+    if (!_stats_take(sensor, &stats)) {
+        return 0;
+    }
+    /* the policy applies to the mean of the window */
+    saul_coap_aggregate_t agg;
+    _stats_aggregate(&agg, &stats);
+    if (!_saul_report_due(sensor, &agg.mean, stats.dim)) {
+        return 0;
+    }
+    _log_append(sensor, &agg.mean, stats.dim);
+    return _saul_encode_stats(buf, len, CONFIG_COAP_SAUL_SEND_FORMAT, name,
+                              &stats, records);
+#else
+    if (!_saul_report_due(sensor, &data, dim)) {
+        return 0;
+    }
+    _log_append(sensor, &data, dim);
+    /* a SenML record per dimension, a text line per reading */
+    *records = CONFIG_COAP_SAUL_SEND_FORMAT == COAP_FORMAT_TEXT ? 1 : dim;
+    return _saul_encode_record(buf, len, CONFIG_COAP_SAUL_SEND_FORMAT, name,
+                               &data, dim);
+#endif
+}
+
+/**
+ * @brief   Posts @p count records, completing the SenML pack header in
+ *          front of them
+ */
+static void _saul_post(uint8_t *payload, size_t len, unsigned count)
+{
+    if (count == 0) {
+        return;
+    }
+#ifdef MODULE_COAP_SAUL_SENML
+    if (CONFIG_COAP_SAUL_SEND_FORMAT == COAP_FORMAT_SENML_CBOR) {
+        payload[0] = SENML_PACK_HDR(count);
+    }
+#endif
+    DEBUG("[DEBUG] saul: sending %u readings in %u bytes\n", count,
+          (unsigned)len);
+    coap_utils_sender_t *gateway = coap_utils_gateway();
+    if (gateway) {
+        coap_utils_send(gateway, &_server_uri, payload, len);
+    }
+}
+
+void saul_coap_send(void *args)
+{
+    saul_coap_sensor_t *sensor = args;
+    uint8_t payload[COAP_SAUL_PAYLOAD_LEN];
+    /* SenML packs start with the array header, set on post */
+    const size_t start =
+        CONFIG_COAP_SAUL_SEND_FORMAT == COAP_FORMAT_SENML_CBOR ? 1 : 0;
+    unsigned records;
+
+    ssize_t len = _saul_report(sensor, payload + start,
+                               sizeof(payload) - start, &records);
+    if (len <= 0) {
+        return;
+    }
+    _saul_post(payload, start + len, records);
+}
+
+void saul_coap_batch_init(saul_coap_batch_t *batch,
+                          saul_coap_batch_item_t *items, unsigned numof,
+                          uint32_t window)
+{
+    batch->items = items;
+    batch->size = numof;
+    batch->numof = 0;
+    batch->window = window;
+    batch->period = 0;
+    batch->phase = 0;
+}
+
+int saul_coap_batch_add(saul_coap_batch_t *batch,
+                        saul_coap_sensor_t *sensor,
+                        uint32_t interval)
+{
+    if (batch->numof >= batch->size || interval == 0) {
+        return -ENOMEM;
+    }
+    /* intervals are rounded to multiples of the window so the batch never
+       runs more often than that, 5000 and 5001 ms would otherwise make it
+       run every ms */
+    if (batch->window) {
+        interval = (interval + batch->window / 2) / batch->window *
+                   batch->window;
+        if (interval == 0) {
+            interval = batch->window;
+        }
+    }
+    saul_coap_batch_item_t *item = &batch->items[batch->numof++];
+    item->sensor = sensor;
+    item->interval = interval;
+    /* first time at or after now aligned on the phase modulo the interval,
+       the batch period is too short to spread the items of a fleet */
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    item->deadline = now + (batch->phase % interval + interval -
+                            now % interval) % interval;
+
+    /* run often enough to meet every interval */
+    uint32_t a = batch->period ? batch->period : interval;
+    uint32_t b = interval;
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    batch->period = a;
+    return 0;
+}
+
+void saul_coap_batch_send(void *args)
+{
+    saul_coap_batch_t *batch = args;
+    uint8_t payload[CONFIG_COAP_SAUL_BATCH_LEN];
+    uint8_t record[COAP_SAUL_PAYLOAD_LEN];
+    /* SenML packs start with the array header, set on post */
+    const size_t start =
+        CONFIG_COAP_SAUL_SEND_FORMAT == COAP_FORMAT_SENML_CBOR ? 1 : 0;
+    size_t pos = start;
+    unsigned count = 0;
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+
+    for (unsigned i = 0; i < batch->numof; i++) {
+        saul_coap_batch_item_t *item = &batch->items[i];
+        /* readings due before the end of the window join this message */
+        if ((int32_t)(item->deadline - now) >= (int32_t)batch->window) {
+            continue;
+        }
+        item->deadline += item->interval;
+        if ((int32_t)(item->deadline - now) < 0) {
+            item->deadline = now + item->interval;
+        }
+
+        /* room is left in front of the records for a SenML header */
+        unsigned records;
+        ssize_t len = _saul_report(item->sensor, record + start,
+                                   sizeof(record) - start, &records);
+        if (len <= 0) {
+            continue;
+        }
+        /* text records are separated by a new line */
+        size_t sep = (start == 0 && count) ? 1 : 0;
+        if (pos + sep + len > sizeof(payload) ||
+            (start && count + records > SENML_PACK_MAX)) {
+            _saul_post(payload, pos, count);
+            pos = start;
+            count = 0;
+            sep = 0;
         }
-        else if (subtype == SAUL_SENSE_PM_2p5) {
-            sprintf((char*)&response, "%s: %s", "pm2p5", data_str);
+        if (pos + len > sizeof(payload)) {
+            /* larger than the budget on its own, send it alone */
+            _saul_post(record, start + len, records);
+            continue;
         }
-        else if (subtype == SAUL_SENSE_PM_10) {
-            sprintf((char*)&response, "%s: %s", "pm10", data_str);
+        if (sep) {
+            payload[pos++] = '\n';
         }
+        memcpy(&payload[pos], record + start, len);
+        pos += len;
+        count += records;
     }
-    send_coap_post((uint8_t*)"/server", response);
+    _saul_post(payload, pos, count);
 }
@@ -2,16 +2,394 @@
 #define COAP_SAUL_H
 
 #include <inttypes.h>
+#include "mutex.h"
 #include "net/gcoap.h"
+#include "saul_reg.h"
+#include "thread.h"
+#include "ztimer.h"
+#ifdef MODULE_COAP_SAUL_LOG_MTD
+#include "mtd.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifndef COAP_FORMAT_SENML_CBOR
+#define COAP_FORMAT_SENML_CBOR          (112)
+#endif
+
+/**
+ * @brief   Content-Format of the readings sent by saul_coap_send(),
+ *          COAP_FORMAT_SENML_CBOR requires the `coap_saul_senml` module
+ */
+#ifndef CONFIG_COAP_SAUL_SEND_FORMAT
+#define CONFIG_COAP_SAUL_SEND_FORMAT    COAP_FORMAT_TEXT
+#endif
+
+/**
+ * @brief   Default time in ms a sample is served from cache to GET requests,
+ *          0 reads the sensor on every request
+ */
+#ifndef CONFIG_COAP_SAUL_MAX_AGE
+#define CONFIG_COAP_SAUL_MAX_AGE        (5 * MS_PER_SEC)
+#endif
+
+/**
+ * @brief   Minimum ms between two notifications of an observed sensor
+ *
+ * The number of observers is bounded by gcoap, see
+ * CONFIG_GCOAP_OBS_CLIENTS_MAX and CONFIG_GCOAP_OBS_REGISTRATIONS_MAX.
+ */
+#ifndef CONFIG_COAP_SAUL_OBS_MIN_INTERVAL
+#define CONFIG_COAP_SAUL_OBS_MIN_INTERVAL   (5 * MS_PER_SEC)
+#endif
+
+/**
+ * @brief   Sampler thread stack size
+ */
+#ifndef CONFIG_COAP_SAUL_SAMPLER_STACKSIZE
+#define CONFIG_COAP_SAUL_SAMPLER_STACKSIZE  (THREAD_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief   Sampler thread priority, below gcoap so slow reads never delay
+ *          a response
+ */
+#ifndef CONFIG_COAP_SAUL_SAMPLER_PRIO
+#define CONFIG_COAP_SAUL_SAMPLER_PRIO       (THREAD_PRIORITY_MAIN)
+#endif
+
+/**
+ * @brief   Payload budget of a batched report, readings that do not fit are
+ *          sent in a further message. The default keeps a report with the
+ *          CoAP, UDP and compressed IPv6 headers within one IEEE 802.15.4
+ *          frame.
+ */
+#ifndef CONFIG_COAP_SAUL_BATCH_LEN
+#define CONFIG_COAP_SAUL_BATCH_LEN      (64U)
+#endif
+
+/**
+ * @brief   Window in ms over which samples are aggregated with
+ *          `coap_saul_stats`
+ */
+#ifndef CONFIG_COAP_SAUL_STATS_WINDOW
+#define CONFIG_COAP_SAUL_STATS_WINDOW   (60 * MS_PER_SEC)
+#endif
+
+/**
+ * @brief   Number of reports kept by `coap_saul_log` in RAM
+ */
+#ifndef CONFIG_COAP_SAUL_LOG_NUMOF
+#define CONFIG_COAP_SAUL_LOG_NUMOF      (64U)
+#endif
+
+/**
+ * @brief   Buckets of the read latency histograms of `coap_saul_latency`,
+ *          bucket i counts reads below 2^(i + 6) us, the last one all
+ *          slower reads
+ */
+#ifndef CONFIG_COAP_SAUL_LATENCY_BUCKETS
+#define CONFIG_COAP_SAUL_LATENCY_BUCKETS    (16U)
+#endif
+
+/**
+ * @brief   Maximum number of resources generated by saul_coap_auto_init()
+ *
+ * Defaults to the number of known sensor types, so every present type is
+ * exposed.
+ */
+#ifndef CONFIG_COAP_SAUL_AUTO_NUMOF
+#define CONFIG_COAP_SAUL_AUTO_NUMOF     (12U)
+#endif
+
+/**
+ * @brief   Report interval in ms of sensor types without a default one
+ */
+#ifndef CONFIG_COAP_SAUL_DEFAULT_INTERVAL
+#define CONFIG_COAP_SAUL_DEFAULT_INTERVAL   (10 * MS_PER_SEC)
+#endif
+
+/**
+ * @brief   Send-on-delta reporting policy
+ *
+ * A reading is reported when it moved by at least one of the thresholds
+ * since the last report, or when @p heartbeat elapsed, but never more
+ * often than @p min_interval. A change of unit or scale is always
+ * reported.
+ */
+typedef struct {
+    uint16_t abs_delta;         /**< absolute threshold in units of the
+                                     sample scale, 0 to disable */
+    uint16_t rel_delta;         /**< relative threshold in per mille of the
+                                     last report, 0 to disable */
+    uint32_t min_interval;      /**< minimum ms between reports */
+    uint32_t heartbeat;         /**< ms after which a report is sent anyway,
+                                     0 for never */
+} saul_coap_policy_t;
+
+/**
+ * @brief   A timestamped sample
+ */
+typedef struct {
+    phydat_t data;              /**< the sample */
+    uint32_t time;              /**< ZTIMER_MSEC time it was taken */
+    uint8_t dim;                /**< dimensions of @p data, 0 if none */
+} saul_coap_snapshot_t;
+
+/**
+ * @brief   Running aggregate of the samples of a window, per dimension
+ *
+ * Mean and variance are kept with Welford's method in fixed point, the
+ * sample unit and scale are those of the first sample of the window.
+ */
+typedef struct {
+    uint32_t start;             /**< ZTIMER_MSEC time of the first sample */
+    uint16_t count;             /**< samples in the window, at most
+                                     INT16_MAX */
+    uint8_t dim;                /**< dimensions of the samples */
+    uint8_t unit;               /**< unit of the samples */
+    int8_t scale;               /**< scale of the samples */
+    int16_t min[PHYDAT_DIM];    /**< smallest sample */
+    int16_t max[PHYDAT_DIM];    /**< largest sample */
+    int32_t mean[PHYDAT_DIM];   /**< mean, Q8 fixed point */
+    int64_t m2[PHYDAT_DIM];     /**< sum of squared differences from the
+                                     mean, Q16 fixed point */
+} saul_coap_stats_t;
+
+/**
+ * @brief   A SAUL backed resource, bound to its device once by
+ *          saul_coap_init() instead of looking it up on every read
+ */
+typedef struct {
+    uint8_t type;               /**< SAUL_SENSE_<TYPE> */
+    uint8_t subtype;            /**< subtype or SAUL_CLASS_ANY */
+    const char *name;           /**< name used in reports */
+    saul_reg_t *dev;            /**< bound device, NULL if not present */
+    mutex_t read_lock;          /**< held while @p dev is read, so a rebind
+                                     never swaps it mid read */
+    uint32_t max_age;           /**< ms a sample is served from cache, and
+                                     sampling period with the sampler */
+    saul_coap_snapshot_t snap[2];   /**< latest and next sample */
+    uint8_t front;              /**< index of the latest sample in @p snap */
+    uint16_t seq;               /**< bumped when @p front moves, readers
+                                     retry on a change */
+    uint8_t reported_dim;       /**< dimensions of @p reported, 0 if none */
+    const saul_coap_policy_t *policy;   /**< report policy, NULL reports
+                                             every reading */
+    phydat_t reported;          /**< last reported sample */
+    uint32_t reported_at;       /**< ZTIMER_MSEC time of @p reported */
+    uint32_t sent;              /**< readings reported */
+    uint32_t suppressed;        /**< readings skipped by the policy */
+#if defined(MODULE_COAP_SAUL_OBSERVE) || defined(DOXYGEN)
+    const coap_resource_t *resource;    /**< observable resource, NULL if
+                                             none */
+    uint16_t obs_format;        /**< Content-Format of the notifications */
+    uint32_t notified_at;       /**< ZTIMER_MSEC time of last notification */
+    uint32_t notified;          /**< notifications sent */
+#endif
+#if defined(MODULE_COAP_SAUL_SAMPLER) || defined(DOXYGEN)
+    uint32_t next_sample;       /**< ZTIMER_MSEC time of the next sample */
+#endif
+#if defined(MODULE_COAP_SAUL_STATS) || defined(DOXYGEN)
+    saul_coap_stats_t stats;    /**< aggregate of the current window */
+    saul_coap_stats_t stats_closed; /**< latest closed window not reported
+                                         yet, count 0 if none */
+#endif
+#if defined(MODULE_COAP_SAUL_LATENCY) || defined(DOXYGEN)
+    uint16_t read_hist[CONFIG_COAP_SAUL_LATENCY_BUCKETS];  /**< read latency
+                                     histogram, saturating */
+    uint32_t read_max;          /**< slowest read in us */
+    uint32_t read_errors;       /**< failed reads */
+#endif
+} saul_coap_sensor_t;
+
+/**
+ * @brief   Static initializer of a saul_coap_sensor_t
+ */
+#define SAUL_COAP_SENSOR(t, s)  SAUL_COAP_SENSOR_POLICY(t, s, NULL)
+
+/**
+ * @brief   Static initializer of a saul_coap_sensor_t reported with
+ *          policy @p p
+ */
+#define SAUL_COAP_SENSOR_POLICY(t, s, p)                                     \
+                                { .type = (t), .subtype = (s), .name = NULL, \
+                                  .dev = NULL,                               \
+                                  .max_age = CONFIG_COAP_SAUL_MAX_AGE,       \
+                                  .policy = (p) }
+
+/**
+ * @brief   A sensor reported by a batch
+ */
+typedef struct {
+    saul_coap_sensor_t *sensor; /**< the sensor */
+    uint32_t interval;          /**< report interval in ms */
+    uint32_t deadline;          /**< next report in ZTIMER_MSEC time */
+} saul_coap_batch_item_t;
+
+/**
+ * @brief   Sensors whose readings are sent together
+ */
+typedef struct {
+    saul_coap_batch_item_t *items;  /**< sensors of the batch */
+    uint8_t size;               /**< capacity of @p items */
+    uint8_t numof;              /**< sensors in use */
+    uint32_t window;            /**< readings due within that many ms are
+                                     pulled into the current message */
+    uint32_t period;            /**< greatest common divisor of the
+                                     intervals, in ms, at least @p window */
+    uint32_t phase;             /**< item deadlines offset in ms, taken
+                                     modulo each item interval */
+} saul_coap_batch_t;
+
+/**
+ * @brief   Binds every sensor of @p sensors to the first matching SAUL
+ *          device
+ *
+ * The table is kept and rebound by saul_coap_rebind(), it must outlive the
+ * resources using it.
+ *
+ * With `coap_saul_sampler` a thread is started that reads every bound
+ * sensor each max_age ms into a double-buffered snapshot. GET handlers,
+ * notifications and reports then only copy the latest snapshot and never
+ * wait on the bus.
+ *
+ * @param[in] sensors   The sensors
+ * @param[in] numof     Number of elements in @p sensors
+ */
+void saul_coap_init(saul_coap_sensor_t *sensors, unsigned numof);
+
+/**
+ * @brief   Rebinds the sensors given to saul_coap_init()
+ *
+ * SAUL does not notify registry changes, this must be called after
+ * devices are added or removed with saul_reg_add() or saul_reg_rm()
+ * directly. saul_coap_reg_add() and saul_coap_reg_rm() do it already.
+ * Only sensors whose device changed lose their cached readings and
+ * statistics, a read in progress on the previous device completes first.
+ */
+void saul_coap_rebind(void);
+
+/**
+ * @brief   saul_reg_add() followed by saul_coap_rebind()
+ */
+int saul_coap_reg_add(saul_reg_t *dev);
+
+/**
+ * @brief   saul_reg_rm() followed by saul_coap_rebind()
+ */
+int saul_coap_reg_rm(saul_reg_t *dev);
+
+#if defined(MODULE_COAP_SAUL_AUTO) || defined(DOXYGEN)
+/**
+ * @brief   Generates a resource for every known sensor type present in the
+ *          SAUL registry and serves them from a listener of its own
+ *
+ * The resources are sorted by path and listed in `/.well-known/core` with
+ * their content formats, and as observable with `coap_saul_observe`. At
+ * most CONFIG_COAP_SAUL_AUTO_NUMOF are generated, a warning names every
+ * present type left out. Devices of a type that is already served are
+ * skipped. This calls saul_coap_init() and
+ * saul_coap_observe_init() with the generated sensors, it replaces them.
+ *
+ * @param[out] sensors  The generated sensors, may be NULL
+ *
+ * @return  number of generated sensors
+ */
+unsigned saul_coap_auto_init(saul_coap_sensor_t **sensors);
+#endif
+
+/**
+ * @brief   Default report interval in ms of the type of @p sensor
+ */
+uint32_t saul_coap_default_interval(const saul_coap_sensor_t *sensor);
+
+#if defined(MODULE_COAP_SAUL_OBSERVE) || defined(DOXYGEN)
+/**
+ * @brief   Makes the saul_coap_handler() resources of @p listener and the
+ *          listeners chained to it observable (RFC 7641)
+ *
+ * Observers are notified of every sample taken by saul_coap_send(),
+ * saul_coap_batch_send() or the sampler, at most once every
+ * CONFIG_COAP_SAUL_OBS_MIN_INTERVAL, in the Content-Format they asked for
+ * with Accept on registration.
+ *
+ * @note    gcoap accepts a single observer per resource, a registration from
+ *          another client while one is registered is answered without the
+ *          Observe option and does not change the notification format.
+ *
+ * @param[in] listener  Listener holding the resources
+ */
+void saul_coap_observe_init(const gcoap_listener_t *listener);
+#endif
+
+#if defined(MODULE_COAP_SAUL_LOG) || defined(DOXYGEN)
+#if defined(MODULE_COAP_SAUL_LOG_MTD) || defined(DOXYGEN)
+/**
+ * @brief   Keeps the report log in @p sectors sectors of @p mtd starting at
+ *          @p sector instead of RAM, resuming after the last entry found
+ *
+ * Must be called before the first report. A sector is erased when the log
+ * wraps into it, its entries are lost at once.
+ *
+ * @param[in] mtd       The device, already initialized
+ * @param[in] sector    First sector of the log
+ * @param[in] sectors   Number of sectors, at least 2
+ *
+ * @return  0 on success
+ * @return  -EINVAL if the region does not fit @p mtd
+ */
+int saul_coap_log_mtd_init(mtd_dev_t *mtd, uint32_t sector, uint32_t sectors);
+#endif
+
+/**
+ * @brief   CoAP handler returning the logged reports, using block2
+ *
+ * Every report sent by saul_coap_send() or saul_coap_batch_send() is kept
+ * in a bounded ring, the oldest entries being overwritten. The first line
+ * is "boot:<epoch> oldest:<seq> until:<seq> now:<ms>" in fixed width,
+ * `oldest` being the oldest entry still available, then one
+ * "<seq> <ms> <name>: <values> <unit>" line per entry with a sequence
+ * number greater than the `since` query parameter and up to `until`, e.g.
+ * `/log?since=41`. Entry lines are padded with spaces to 80 bytes.
+ *
+ * Sequence numbers restart on every boot of a node logging to RAM, the
+ * epoch then changes; with `coap_saul_log_mtd` it is always 0. A `since`
+ * passed with the `boot` epoch it was read in, e.g.
+ * `/log?since=41&boot=1f3a52c7`, is ignored if the epoch changed, as is a
+ * `since` beyond the last entry: the whole log is returned.
+ *
+ * The entries are formatted straight from the ring for the requested
+ * block only, starting at the first entry the block overlaps. Blocks after the first must repeat the `until`, `now` and
+ * `boot` values of the first line, e.g.
+ * `/log?since=41&until=97&now=0000123456&boot=1f3a52c7`, so that every
+ * block is cut from the same text. 4.12 is returned once the log wrapped
+ * over that range or the node rebooted, the transfer must then restart
+ * from the first block.
+ */
+ssize_t saul_coap_log_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                              void *ctx);
+#endif
+
 /**
  * @brief   Saul Coap Handler
  *
- * @param[in] ctx   SAUL_SENSE_<TYPE> to send data, should be specified in the
+ * Responds with text by default, a SenML-CBOR record is returned instead
+ * when the request Accept option asks for it and `coap_saul_senml` is used.
+ * Every dimension of the sample is encoded: as comma separated values in
+ * text, as one record per dimension suffixed _x, _y and _z in SenML.
+ * Any other Accept value is answered with 4.06 and a sensor missing on the
+ * board with 4.04.
+ *
+ * Samples younger than the sensor max age are served from cache, which
+ * saul_coap_send() and saul_coap_batch_send() refresh. The Max-Age option
+ * of the response is the remaining freshness in seconds. With
+ * `coap_saul_sampler` the latest snapshot is always served, 5.03 is
+ * returned until the first one is taken.
+ *
+ * @param[in] ctx   saul_coap_sensor_t to read, should be specified in the
  *                  coap_resource_t array.
  *
  */
@@ -19,13 +397,118 @@ ssize_t saul_coap_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len, void *ctx);
 
 /**
  * @brief   Sends a string with sensor data of SAUL_SENSE_<TYPE> passed through
- *          args
+ *          args, encoded as CONFIG_COAP_SAUL_SEND_FORMAT
+ *
+ * Nothing is sent if the sensor report policy suppresses the reading.
  *
- * @param[in] args   Pointer to SAUL_SENSE_<TYPE> to send data
+ * With `coap_saul_stats` the samples taken by the sampler, or for reports
+ * without it, are aggregated instead over windows of
+ * CONFIG_COAP_SAUL_STATS_WINDOW, GET reads are left out. The latest closed
+ * window is sent as the records <name>_mean, _min, _max, _sd and _n, the
+ * mean at the scale of the samples. The policy then applies to the mean.
+ * Aggregates of multi-dimensional sensors may need a larger
+ * CONFIG_GCOAP_PDU_BUF_SIZE.
+ *
+ * @param[in] args   Pointer to the saul_coap_sensor_t to send data
  *
  */
 void saul_coap_send(void *args);
 
+/**
+ * @brief   Prints the sent and suppressed reports of every sensor
+ */
+int saul_coap_report_cmd(int argc, char **argv);
+
+#if defined(MODULE_COAP_SAUL_LATENCY) || defined(DOXYGEN)
+/**
+ * @brief   Shell command printing the read latency histogram and error
+ *          count of every sensor
+ *
+ * One line per sensor: "<name> n:<reads> err:<errors> max:<us>" followed
+ * by "<bound>:<count>" for every non-empty bucket, @p bound being its upper
+ * bound in us, or "inf" for the last one.
+ */
+int saul_coap_latency_cmd(int argc, char **argv);
+
+/**
+ * @brief   CoAP handler returning the lines of saul_coap_latency_cmd(),
+ *          using block2 if needed
+ */
+ssize_t saul_coap_latency_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                                  void *ctx);
+#endif
+
+/**
+ * @brief   Initializes an empty batch
+ *
+ * @param[out] batch    The batch
+ * @param[in] items     Storage for the sensors of the batch
+ * @param[in] numof     Number of elements in @p items
+ * @param[in] window    Readings due within that many ms are sent in the
+ *                      same message
+ */
+void saul_coap_batch_init(saul_coap_batch_t *batch,
+                          saul_coap_batch_item_t *items, unsigned numof,
+                          uint32_t window);
+
+/**
+ * @brief   Sets the offset of the item deadlines of a batch
+ *
+ * Every item is reported at the times congruent to @p phase modulo its own
+ * interval, so nodes with different phases, e.g. from
+ * schedreg_node_offset(), spread their reports over each interval instead
+ * of over the batch period only.
+ *
+ * @note    Must be set before saul_coap_batch_add()
+ *
+ * @param[in] batch     The batch
+ * @param[in] phase     The deadlines offset in ms
+ */
+static inline void saul_coap_batch_set_phase(saul_coap_batch_t *batch,
+                                             uint32_t phase)
+{
+    batch->phase = phase;
+}
+
+/**
+ * @brief   Adds a sensor to a batch, it is first reported on the first run
+ *          at or after its next deadline aligned on the batch phase
+ *
+ * With a non zero window @p interval is rounded to the nearest multiple of
+ * the window, at least one window, so that the batch period never drops
+ * below it.
+ *
+ * @param[in] batch     The batch
+ * @param[in] sensor    The sensor
+ * @param[in] interval  Report interval in ms
+ *
+ * @return  0 on success
+ * @return  -ENOMEM if the batch is full or @p interval is 0
+ */
+int saul_coap_batch_add(saul_coap_batch_t *batch,
+                        saul_coap_sensor_t *sensor, uint32_t interval);
+
+/**
+ * @brief   Period in ms at which saul_coap_batch_send() must run
+ */
+static inline uint32_t saul_coap_batch_period(const saul_coap_batch_t *batch)
+{
+    return batch->period;
+}
+
+/**
+ * @brief   Sends the readings of every sensor of the batch passed through
+ *          args that is due within the window, in as few messages of at
+ *          most CONFIG_COAP_SAUL_BATCH_LEN bytes as possible
+ *
+ * Text readings are separated by new lines, SenML-CBOR readings are
+ * records of a single pack. With `coap_saul_stats` readings are the window
+ * aggregates described in saul_coap_send().
+ *
+ * @param[in] args   Pointer to a saul_coap_batch_t
+ */
+void saul_coap_batch_send(void *args);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,48 +1,150 @@
+#include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "mutex.h"
 #include "net/gcoap.h"
 #include "coap_utils.h"
 
 #define ENABLE_DEBUG (0)
 #include "debug.h"
 
-void send_coap_post(uint8_t* uri_path, uint8_t *data)
+/* requests are assembled here, one at a time */
+static uint8_t _buf[CONFIG_GCOAP_PDU_BUF_SIZE];
+static mutex_t _buf_lock = MUTEX_INIT;
+
+static coap_utils_sender_t _gateway;
+static bool _gateway_resolved;
+
+static int _sender_init(coap_utils_sender_t *sender, const char *addr,
+                        uint16_t port)
 {
     /* format destination address from string */
     ipv6_addr_t remote_addr;
-    if (ipv6_addr_from_str(&remote_addr, CONFIG_GATEWAY_ADDR) == NULL) {
-        DEBUG("[ERROR]: address not valid '%s'\n", CONFIG_GATEWAY_ADDR);
-        return;
+    if (ipv6_addr_from_str(&remote_addr, addr) == NULL) {
+        DEBUG("[ERROR]: address not valid '%s'\n", addr);
+        return -EINVAL;
     }
 
-    DEBUG("[DEBUG] utils: sending to '%s'\n", CONFIG_GATEWAY_ADDR);
-    sock_udp_ep_t remote;
+    sender->remote.family = AF_INET6;
+    sender->remote.netif  = SOCK_ADDR_ANY_NETIF;
+    sender->remote.port   = port;
+    memcpy(&sender->remote.addr.ipv6[0], &remote_addr.u8[0],
+           sizeof(remote_addr.u8));
+    return 0;
+}
 
-    remote.family = AF_INET6;
-    remote.netif  = SOCK_ADDR_ANY_NETIF;
-    remote.port   = CONFIG_GATEWAY_PORT;
+int coap_utils_sender_init(coap_utils_sender_t *sender, const char *addr,
+                           uint16_t port)
+{
+    /* never rewritten while a request of that sender is assembled */
+    mutex_lock(&_buf_lock);
+    int res = _sender_init(sender, addr, port);
+    mutex_unlock(&_buf_lock);
+    return res;
+}
+
+coap_utils_sender_t *coap_utils_gateway(void)
+{
+    coap_utils_sender_t *gateway = &_gateway;
+
+    /* resolved once, the lock keeps racing first calls from rewriting it
+       while another thread sends through it */
+    mutex_lock(&_buf_lock);
+    if (!_gateway_resolved) {
+        if (_sender_init(&_gateway, CONFIG_GATEWAY_ADDR,
+                         CONFIG_GATEWAY_PORT) == 0) {
+            DEBUG("[DEBUG] utils: sending to '%s'\n", CONFIG_GATEWAY_ADDR);
+            _gateway_resolved = true;
+        }
+        else {
+            gateway = NULL;
+        }
+    }
+    mutex_unlock(&_buf_lock);
+    return gateway;
+}
+
+int coap_utils_uri_init(coap_utils_uri_t *uri, const char *uri_path,
+                        uint16_t format)
+{
+    size_t path_len = strlen(uri_path);
+    size_t segments = 0;
+
+    for (size_t i = 0; i < path_len; i++) {
+        segments += uri_path[i] == '/';
+    }
+    /* every segment takes up to two header bytes in place of its '/', the
+       Content-Format option up to three bytes */
+    if (path_len + segments + 3 > sizeof(uri->opts)) {
+        return -ENOBUFS;
+    }
+    size_t len = coap_opt_put_uri_path(uri->opts, 0, uri_path);
+    len += coap_opt_put_uint(&uri->opts[len], COAP_OPT_URI_PATH,
+                             COAP_OPT_CONTENT_FORMAT, format);
+    uri->opts_len = len;
+    return 0;
+}
 
-    memcpy(&remote.addr.ipv6[0], &remote_addr.u8[0], sizeof(remote_addr.u8));
+int coap_utils_send(coap_utils_sender_t *sender, const coap_utils_uri_t *uri,
+                    const uint8_t *data, size_t data_len)
+{
+    int res = 0;
 
-    uint8_t buf[CONFIG_GCOAP_PDU_BUF_SIZE];
+    mutex_lock(&_buf_lock);
+    /* message ID and token are drawn by gcoap like for any other request */
     coap_pkt_t pdu;
-    size_t len;
-    gcoap_req_init(&pdu, &buf[0], CONFIG_GCOAP_PDU_BUF_SIZE, COAP_METHOD_POST, (char*)uri_path);
+    if (gcoap_req_init(&pdu, _buf, sizeof(_buf), COAP_METHOD_POST,
+                       NULL) != 0) {
+        res = -ENOBUFS;
+        goto out;
+    }
     coap_hdr_set_type(pdu.hdr, COAP_TYPE_NON);
-    coap_opt_add_format(&pdu, COAP_FORMAT_TEXT);
-    len = coap_opt_finish(&pdu, COAP_OPT_FINISH_PAYLOAD);
+    size_t len = coap_get_total_hdr_len(&pdu);
+    if (len + uri->opts_len + 1 + data_len > sizeof(_buf)) {
+        DEBUG("[ERROR] utils: %u bytes do not fit\n", (unsigned)data_len);
+        res = -ENOBUFS;
+        goto out;
+    }
+    memcpy(&_buf[len], uri->opts, uri->opts_len);
+    len += uri->opts_len;
+    if (data_len) {
+        _buf[len++] = COAP_PAYLOAD_MARKER;
+        memcpy(&_buf[len], data, data_len);
+        len += data_len;
+    }
 
-    if (pdu.payload_len >= strlen((char*)data)) {
-        memcpy(pdu.payload, (char*)data, strlen((char*)data));
-        len += strlen((char*)data);
+    DEBUG("[INFO] Sending %u bytes\n", (unsigned)data_len);
+    if (gcoap_req_send(_buf, len, &sender->remote, NULL, NULL) == 0) {
+        res = -EIO;
     }
-    else {
+out:
+    mutex_unlock(&_buf_lock);
+    return res;
+}
+
+void send_coap_post_data(uint8_t* uri_path, uint16_t format,
+                         const uint8_t *data, size_t data_len)
+{
+    coap_utils_sender_t *gateway = coap_utils_gateway();
+    coap_utils_uri_t uri;
+
+    if (gateway == NULL) {
+        return;
+    }
+    if (coap_utils_uri_init(&uri, (char *)uri_path, format) != 0) {
+        DEBUG("[ERROR] utils: path too long '%s'\n", (char *)uri_path);
+        return;
+    }
+    if (coap_utils_send(gateway, &uri, data, data_len) == -ENOBUFS) {
         puts("gcoap_cli: msg buffer too small");
     }
+}
 
-    DEBUG("[INFO] Sending '%s' to '%s:%i%s'\n", data,
-        CONFIG_GATEWAY_ADDR, CONFIG_GATEWAY_PORT, uri_path);
-
-    gcoap_req_send(&buf[0], len, &remote, NULL, NULL);
+void send_coap_post(uint8_t* uri_path, uint8_t *data)
+{
+    send_coap_post_data(uri_path, COAP_FORMAT_TEXT, data, strlen((char*)data));
 }
@@ -4,6 +4,8 @@
 #include <inttypes.h>
 #include <stdlib.h>
 
+#include "net/gcoap.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -16,8 +18,107 @@ extern "C" {
 #define CONFIG_GATEWAY_PORT      (5685)
 #endif
 
+/**
+ * @brief   Size of the options template of a URI, bounds the length of its
+ *          path
+ */
+#ifndef CONFIG_COAP_UTILS_TEMPLATE_LEN
+#define CONFIG_COAP_UTILS_TEMPLATE_LEN  (32U)
+#endif
+
+/**
+ * @brief   A resolved destination of NON POST requests
+ */
+typedef struct {
+    sock_udp_ep_t remote;       /**< resolved endpoint */
+} coap_utils_sender_t;
+
+/**
+ * @brief   Prebuilt options of the requests to a URI
+ */
+typedef struct {
+    uint8_t opts[CONFIG_COAP_UTILS_TEMPLATE_LEN];   /**< Uri-Path and
+                                                         Content-Format */
+    uint8_t opts_len;           /**< length of @p opts */
+} coap_utils_uri_t;
+
+/**
+ * @brief   Resolves @p addr once for all requests sent through @p sender
+ *
+ * @param[out] sender   The sender
+ * @param[in] addr      IPv6 address of the destination
+ * @param[in] port      UDP port of the destination
+ *
+ * @return  0 on success
+ * @return  -EINVAL if @p addr is not a valid IPv6 address
+ */
+int coap_utils_sender_init(coap_utils_sender_t *sender, const char *addr,
+                           uint16_t port);
+
+/**
+ * @brief   The sender to CONFIG_GATEWAY_ADDR and CONFIG_GATEWAY_PORT,
+ *          resolved on first use, safe to call from several threads
+ *
+ * @return  the sender, NULL if CONFIG_GATEWAY_ADDR is not valid
+ */
+coap_utils_sender_t *coap_utils_gateway(void);
+
+/**
+ * @brief   Builds the options of the requests to @p uri_path once
+ *
+ * @param[out] uri      The template
+ * @param[in] uri_path  Path of the resource
+ * @param[in] format    Content-Format of the payloads
+ *
+ * @return  0 on success
+ * @return  -ENOBUFS if the options do not fit
+ *          CONFIG_COAP_UTILS_TEMPLATE_LEN
+ */
+int coap_utils_uri_init(coap_utils_uri_t *uri, const char *uri_path,
+                        uint16_t format);
+
+/**
+ * @brief   Sends a NON POST of @p data to a prebuilt URI
+ *
+ * Only the CoAP header is written per request, with a message ID and token
+ * from gcoap, the datagram is assembled in a buffer shared by all senders so
+ * callers need no PDU buffer on their stack.
+ *
+ * @param[in] sender    The destination
+ * @param[in] uri       The resource
+ * @param[in] data      Payload, may be NULL if @p data_len is 0
+ * @param[in] data_len  Length of @p data
+ *
+ * @return  0 on success
+ * @return  -ENOBUFS if the request exceeds CONFIG_GCOAP_PDU_BUF_SIZE
+ * @return  -EIO if it could not be sent
+ */
+int coap_utils_send(coap_utils_sender_t *sender, const coap_utils_uri_t *uri,
+                    const uint8_t *data, size_t data_len);
+
+/**
+ * @brief   Sends a NON POST with a text payload to the gateway
+ *
+ * @param[in] uri_path  Path of the gateway resource
+ * @param[in] data      Null terminated payload
+ */
 void send_coap_post(uint8_t* uri_path, uint8_t *data);
 
+/**
+ * @brief   Sends a NON POST with a payload of any content format to the
+ *          gateway
+ *
+ * The options are built on every call, senders of frequent requests should
+ * prefer coap_utils_send() with a template built by coap_utils_uri_init().
+ *
+ * @param[in] uri_path  Path of the gateway resource
+ * @param[in] format    Content-Format of @p data, e.g. COAP_FORMAT_TEXT
+ * @param[in] data      Payload
+ * @param[in] data_len  Length of @p data
+ */
+void send_coap_post_data(uint8_t* uri_path, uint16_t format,
+                         const uint8_t *data, size_t data_len);
+
 #ifdef __cplusplus
 }
 #endif
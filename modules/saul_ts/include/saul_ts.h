@@ -0,0 +1,119 @@
+#ifndef SAUL_TS_H
+#define SAUL_TS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "phydat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Largest encoded sample, in bytes
+ */
+#define SAUL_TS_SAMPLE_MAX      (5 + 3 + PHYDAT_DIM * 3)
+
+/**
+ * @brief   Prediction state shared by the encoder and the decoder
+ *
+ * Timestamps are coded as the zig-zag varint of their delta-of-delta,
+ * shifted left by one to flag a reset. Values are coded as the zig-zag
+ * varint of their delta to the previous sample, a reset record carries
+ * the dimension, unit and scale followed by the absolute values. The first
+ * sample of a stream and any change of dimension, unit or scale is a reset.
+ */
+typedef struct {
+    uint32_t time;              /**< time of the previous sample */
+    uint32_t delta;             /**< previous time delta */
+    int16_t val[PHYDAT_DIM];    /**< previous values */
+    uint8_t dim;                /**< dimensions, 0 before the first sample */
+    uint8_t unit;               /**< unit of the samples */
+    int8_t scale;               /**< scale of the samples */
+} saul_ts_state_t;
+
+/**
+ * @brief   Incremental encoder writing to a caller provided buffer
+ */
+typedef struct {
+    saul_ts_state_t state;      /**< prediction state */
+    uint8_t *buf;               /**< output buffer */
+    size_t len;                 /**< size of @p buf */
+    size_t pos;                 /**< bytes written */
+} saul_ts_encoder_t;
+
+/**
+ * @brief   Incremental decoder reading from a caller provided buffer
+ */
+typedef struct {
+    saul_ts_state_t state;      /**< prediction state */
+    const uint8_t *buf;         /**< input buffer */
+    size_t len;                 /**< size of @p buf */
+    size_t pos;                 /**< bytes read */
+} saul_ts_decoder_t;
+
+/**
+ * @brief   Starts a new stream in @p buf
+ *
+ * Every stream decodes on its own, a full history buffer or an uplink
+ * payload is closed by starting a new stream in the next one.
+ *
+ * @param[out] enc      The encoder
+ * @param[in] buf       Output buffer
+ * @param[in] len       Size of @p buf
+ */
+void saul_ts_encoder_init(saul_ts_encoder_t *enc, uint8_t *buf, size_t len);
+
+/**
+ * @brief   Appends a sample to the stream
+ *
+ * @param[in] enc       The encoder
+ * @param[in] time      Time of the sample, in any unit that wraps at 2^32
+ * @param[in] data      The sample
+ * @param[in] dim       Dimensions of @p data, 1 to PHYDAT_DIM
+ *
+ * @return  bytes appended
+ * @return  -ENOBUFS if the sample does not fit, the stream is unchanged
+ * @return  -EINVAL if @p dim is out of range
+ */
+int saul_ts_encode(saul_ts_encoder_t *enc, uint32_t time,
+                   const phydat_t *data, uint8_t dim);
+
+/**
+ * @brief   Length of the stream written so far
+ */
+static inline size_t saul_ts_encoder_len(const saul_ts_encoder_t *enc)
+{
+    return enc->pos;
+}
+
+/**
+ * @brief   Starts decoding the stream in @p buf
+ *
+ * @param[out] dec      The decoder
+ * @param[in] buf       The stream
+ * @param[in] len       Length of the stream
+ */
+void saul_ts_decoder_init(saul_ts_decoder_t *dec, const uint8_t *buf,
+                          size_t len);
+
+/**
+ * @brief   Decodes the next sample of the stream
+ *
+ * @param[in] dec       The decoder
+ * @param[out] time     Time of the sample
+ * @param[out] data     The sample
+ *
+ * @return  dimensions of the sample
+ * @return  0 at the end of the stream
+ * @return  -EBADMSG if the stream is truncated or malformed, the decoder
+ *          is unchanged
+ */
+int saul_ts_decode(saul_ts_decoder_t *dec, uint32_t *time, phydat_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAUL_TS_H */
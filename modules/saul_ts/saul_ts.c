@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "saul_ts.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+static inline uint32_t _zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t _unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t _put_varint(uint8_t *buf, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = (uint8_t)v;
+    return n;
+}
+
+static int _get_varint(saul_ts_decoder_t *dec, uint64_t *v)
+{
+    *v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (dec->pos >= dec->len) {
+            return -EBADMSG;
+        }
+        uint8_t b = dec->buf[dec->pos++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+    }
+    return -EBADMSG;
+}
+
+void saul_ts_encoder_init(saul_ts_encoder_t *enc, uint8_t *buf, size_t len)
+{
+    memset(&enc->state, 0, sizeof(enc->state));
+    enc->buf = buf;
+    enc->len = len;
+    enc->pos = 0;
+}
+
+int saul_ts_encode(saul_ts_encoder_t *enc, uint32_t time,
+                   const phydat_t *data, uint8_t dim)
+{
+    saul_ts_state_t *state = &enc->state;
+    uint8_t sample[SAUL_TS_SAMPLE_MAX];
+    size_t n = 0;
+
+    if (dim == 0 || dim > PHYDAT_DIM) {
+        return -EINVAL;
+    }
+    bool reset = state->dim != dim || state->unit != data->unit ||
+                 state->scale != data->scale;
+    uint32_t delta = time - state->time;
+    int32_t dod = (int32_t)(delta - state->delta);
+
+    /* encoded aside, the stream only changes if the sample fits */
+    n += _put_varint(&sample[n], ((uint64_t)_zigzag(dod) << 1) | reset);
+    if (reset) {
+        sample[n++] = dim;
+        sample[n++] = data->unit;
+        sample[n++] = (uint8_t)data->scale;
+    }
+    for (unsigned i = 0; i < dim; i++) {
+        int32_t v = reset ? data->val[i] : data->val[i] - state->val[i];
+        n += _put_varint(&sample[n], _zigzag(v));
+    }
+    if (enc->pos + n > enc->len) {
+        return -ENOBUFS;
+    }
+    memcpy(&enc->buf[enc->pos], sample, n);
+    enc->pos += n;
+
+    state->time = time;
+    state->delta = delta;
+    memcpy(state->val, data->val, dim * sizeof(data->val[0]));
+    state->dim = dim;
+    state->unit = data->unit;
+    state->scale = data->scale;
+    return n;
+}
+
+void saul_ts_decoder_init(saul_ts_decoder_t *dec, const uint8_t *buf,
+                          size_t len)
+{
+    memset(&dec->state, 0, sizeof(dec->state));
+    dec->buf = buf;
+    dec->len = len;
+    dec->pos = 0;
+}
+
+int saul_ts_decode(saul_ts_decoder_t *dec, uint32_t *time, phydat_t *data)
+{
+    saul_ts_state_t *state = &dec->state;
+    uint64_t v;
+
+    if (dec->pos >= dec->len) {
+        return 0;
+    }
+    /* a malformed sample leaves the decoder where it was */
+    size_t start = dec->pos;
+    if (_get_varint(dec, &v) != 0 || v >> 33) {
+        goto error;
+    }
+    bool reset = v & 1;
+    uint32_t delta = state->delta + _unzigzag(v >> 1);
+    uint8_t dim = state->dim;
+    uint8_t unit = state->unit;
+    int8_t scale = state->scale;
+    int32_t vals[PHYDAT_DIM];
+
+    /* decoded aside, the state only changes if the whole sample is valid */
+    if (reset) {
+        if (dec->pos + 3 > dec->len) {
+            goto error;
+        }
+        dim = dec->buf[dec->pos++];
+        unit = dec->buf[dec->pos++];
+        scale = (int8_t)dec->buf[dec->pos++];
+        if (dim == 0 || dim > PHYDAT_DIM) {
+            goto error;
+        }
+    }
+    else if (dim == 0) {
+        DEBUG_PUTS("[saul_ts] stream does not start with a reset");
+        goto error;
+    }
+    for (unsigned i = 0; i < dim; i++) {
+        if (_get_varint(dec, &v) != 0 || v >> 32) {
+            goto error;
+        }
+        vals[i] = _unzigzag(v);
+        if (!reset) {
+            vals[i] += state->val[i];
+        }
+    }
+    for (unsigned i = 0; i < dim; i++) {
+        state->val[i] = vals[i];
+    }
+    state->dim = dim;
+    state->unit = unit;
+    state->scale = scale;
+    state->time += delta;
+    state->delta = delta;
+
+    *time = state->time;
+    memset(data, 0, sizeof(*data));
+    memcpy(data->val, state->val, state->dim * sizeof(data->val[0]));
+    data->unit = state->unit;
+    data->scale = state->scale;
+    return state->dim;
+
+error:
+    dec->pos = start;
+    return -EBADMSG;
+}
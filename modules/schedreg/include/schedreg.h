@@ -3,9 +3,17 @@
 #define SCHEDREG_H
 
 #include <inttypes.h>
+#include <string.h>
 
 #include "msg.h"
+#include "thread.h"
 #include "ztimer.h"
+#ifdef MODULE_GCOAP
+#include "net/gcoap.h"
+#endif
+#ifdef MODULE_SCHEDREG_EVENT
+#include "event/thread.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +33,99 @@ extern "C" {
 #define CONFIG_SCHEDREG_QUEUE_SIZE      (4U)
 #endif
 
+/**
+ * @brief Number of slots in the schedreg table, i.e. the maximum number of
+ *        simultaneously registered entries
+ */
+#ifndef CONFIG_SCHEDREG_NUMOF
+#define CONFIG_SCHEDREG_NUMOF           (16U)
+#endif
+
+/**
+ * @brief Number of worker threads running callbacks, with
+ *        `schedreg_workers`. When more than one, the first worker is
+ *        reserved to @ref SCHEDREG_PRIO_HIGH entries.
+ */
+#ifndef CONFIG_SCHEDREG_WORKERS_NUMOF
+#define CONFIG_SCHEDREG_WORKERS_NUMOF   (2U)
+#endif
+
+/**
+ * @brief Stack size of each worker thread
+ */
+#ifndef CONFIG_SCHEDREG_WORKER_STACKSIZE
+#define CONFIG_SCHEDREG_WORKER_STACKSIZE    (THREAD_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief Maximum number of missed runs executed back to back by
+ *        @ref SCHEDREG_OVERRUN_BURST entries
+ */
+#ifndef CONFIG_SCHEDREG_BURST_MAX
+#define CONFIG_SCHEDREG_BURST_MAX       (4U)
+#endif
+
+/**
+ * @brief Delay in ms before retrying an expiry that could not be queued
+ *        because the schedreg thread message queue was full
+ */
+#ifndef CONFIG_SCHEDREG_RETRY_DELAY
+#define CONFIG_SCHEDREG_RETRY_DELAY     (10U)
+#endif
+
+/**
+ * @brief Event queue handling expiries with `schedreg_event`
+ */
+#ifndef SCHEDREG_EVENT_QUEUE
+#define SCHEDREG_EVENT_QUEUE            EVENT_PRIO_MEDIUM
+#endif
+
+/**
+ * @brief Value of an unregistered entry handle
+ */
+#define SCHEDREG_HANDLE_INVALID         (UINT32_MAX)
+
+/**
+ * @brief   Entry flags
+ * @{
+ */
+/**
+ * @brief   Deadlines are absolute: each deadline is the previous one plus the
+ *          period, aligned on @ref schedreg_t::phase, so that queueing delay
+ *          and callback time never accumulate as drift
+ */
+#define SCHEDREG_FLAG_ABSOLUTE          (0x01)
+/**
+ * @brief   Entry is registered but paused, see schedreg_pause()
+ */
+#define SCHEDREG_FLAG_PAUSED            (0x02)
+/**
+ * @brief   The phase was derived from the node, see schedreg_set_node_phase()
+ */
+#define SCHEDREG_FLAG_NODE_PHASE        (0x04)
+/** @} */
+
+/**
+ * @brief   Priority classes, with `schedreg_workers` ready jobs are run by
+ *          class first and earliest deadline first within a class
+ */
+typedef enum {
+    SCHEDREG_PRIO_NORMAL = 0,   /**< default class */
+    SCHEDREG_PRIO_HIGH,         /**< short urgent jobs, never queued behind
+                                     normal ones */
+} schedreg_prio_t;
+
+/**
+ * @brief   Overrun policies, i.e. what to do with deadlines that elapsed
+ *          without a run because an expiry was lost or a run overlapped
+ */
+typedef enum {
+    SCHEDREG_OVERRUN_SKIP = 0,  /**< drop missed runs, default */
+    SCHEDREG_OVERRUN_CATCH_UP,  /**< replace all missed runs by a single one */
+    SCHEDREG_OVERRUN_BURST,     /**< execute missed runs back to back, up to
+                                     @ref CONFIG_SCHEDREG_BURST_MAX */
+} schedreg_overrun_t;
+
 /**
  * @brief Signature for the sched callback
  *
@@ -33,18 +134,71 @@ extern "C" {
  */
 typedef void (*sched_cb_t)(void *arg);
 
+/**
+ * @brief   Per entry runtime statistics, enabled by the `schedreg_stats`
+ *          module
+ */
+typedef struct {
+    uint32_t runs;          /**< number of callback executions */
+    uint32_t exec_min;      /**< shortest callback execution, in us */
+    uint32_t exec_max;      /**< longest callback execution, in us */
+    uint64_t exec_total;    /**< sum of callback executions, in us */
+    uint32_t late_max;      /**< largest dispatch lateness, in ms */
+    uint32_t missed;        /**< periods elapsed without a run */
+    uint32_t overlaps;      /**< runs that lasted longer than the period */
+    uint32_t dropped;       /**< expiries lost on a full message queue */
+} schedreg_stats_t;
+
 /**
  * @brief   Schedule entry
+ *
+ * With the `schedreg_single_timer` module all entries share a single
+ * ZTIMER_MSEC timer armed for the earliest deadline, @p msg and @p timer
+ * are then unused and can be NULL.
+ *
+ * With the `schedreg_event` module expiries are posted as events to
+ * @ref SCHEDREG_EVENT_QUEUE and handled by the shared event thread instead
+ * of a schedreg thread, @p msg is then unused and can be NULL.
  */
 typedef struct schedreg {
-    struct schedreg* next;  /**< pointer to next entry */
     sched_cb_t cb;          /**< cb to execute upon message*/
     void* arg;              /**< cb args */
     msg_t* msg;             /**< msg to send */
     ztimer_t* timer;        /**< ztimer to schedule msg send */
     uint32_t period;        /**< message period */
+    uint32_t handle;        /**< slot index and generation, set on register */
+    uint32_t deadline;      /**< next expiry, in ZTIMER_MSEC ticks */
+    uint32_t slack;         /**< coalescing window in ms, the entry may run
+                                 this early to share another entry wakeup */
+    uint32_t phase;         /**< offset of the deadlines in absolute mode */
+    int32_t lateness;       /**< lateness of the last run in ms, negative if
+                                 it was run early */
+    uint32_t jitter;        /**< lateness jitter estimate, in 1/16 ms */
+    uint32_t rel_deadline;  /**< completion deadline in ms after release,
+                                 0 for the period */
+    uint8_t flags;          /**< SCHEDREG_FLAG_* */
+    uint8_t prio;           /**< @ref schedreg_prio_t */
+    uint8_t overrun;        /**< @ref schedreg_overrun_t */
+#if defined(MODULE_SCHEDREG_STATS) || defined(DOXYGEN)
+    schedreg_stats_t stats; /**< runtime statistics */
+#endif
+#if defined(MODULE_SCHEDREG_EVENT) || defined(DOXYGEN)
+    event_t event;          /**< expiry event */
+#endif
 } schedreg_t;
 
+/**
+ * @brief   Wakeup counters of the schedreg thread
+ */
+typedef struct {
+    uint32_t wakeups;       /**< number of wakeups that ran at least one entry */
+    uint32_t saved;         /**< runs pulled forward into another wakeup */
+    uint32_t dropped;       /**< expiries lost on a full message queue, the
+                                 timer is re-armed when it happens */
+    uint32_t offsets;       /**< registrations of entries carrying a per
+                                 node phase offset */
+} schedreg_wakeup_stats_t;
+
 /**
  * @brief   Registers a thread to the registry.
  *
@@ -54,19 +208,160 @@ typedef struct schedreg {
  * @warning Call schedreg_unregister() *before* you leave the context you
  *          allocated @p entry in. Otherwise it might get overwritten.
  *
+ * The entry is bound to a free slot of the table, its handle (slot index
+ * and slot generation) is carried in msg.content.value so that dispatching
+ * an expiry is a constant time table lookup.
+ *
+ * Registration only masks interrupts for the duration of the slot
+ * update, it can be called from any thread or from interrupt context.
+ *
  * @return  0 on success
  * @return  -EINVAL if invalid entry
+ * @return  -ENOMEM if all @ref CONFIG_SCHEDREG_NUMOF slots are in use
  */
 int schedreg_register(schedreg_t *entry, kernel_pid_t pid);
 
+/**
+ * @brief   Sets the coalescing window of an entry
+ *
+ * When the schedreg thread wakes up, every entry whose deadline is at most
+ * @p slack ms away is run back to back in the same wakeup.
+ *
+ * @note    Must be set before schedreg_register()
+ *
+ * @param[in] entry     The entry
+ * @param[in] slack     The window in ms, 0 to disable coalescing
+ */
+static inline void schedreg_set_slack(schedreg_t *entry, uint32_t slack)
+{
+    entry->slack = slack;
+}
+
+/**
+ * @brief   Switches an entry to absolute deadlines
+ *
+ * Deadlines fall on `phase + k * period` in ZTIMER_MSEC time and the next
+ * deadline is always computed from the previous one. If a run is so late
+ * that the next deadline has already elapsed it is skipped, keeping phase.
+ *
+ * @note    Must be set before schedreg_register()
+ *
+ * @param[in] entry     The entry
+ * @param[in] phase     The deadlines offset in ms
+ */
+static inline void schedreg_set_absolute(schedreg_t *entry, uint32_t phase)
+{
+    entry->flags |= SCHEDREG_FLAG_ABSOLUTE;
+    entry->flags &= ~SCHEDREG_FLAG_NODE_PHASE;
+    entry->phase = phase;
+}
+
+#if defined(MODULE_SCHEDREG_PHASE) || defined(DOXYGEN)
+/**
+ * @brief   Per node offset in ms, the LUID hash plus a random offset in
+ *          [0, @p jitter] ms
+ *
+ * Taken modulo a period it gives the phase schedreg_set_node_phase() sets,
+ * for schedules that are not driven by a single entry, e.g. items of a
+ * batch with their own intervals.
+ *
+ * @param[in] jitter    Bound of the random offset in ms, 0 to disable
+ *
+ * @return  the offset in ms
+ */
+uint32_t schedreg_node_offset(uint32_t jitter);
+
+/**
+ * @brief   Switches an entry to absolute deadlines with a per node phase
+ *
+ * The phase is derived from the node LUID so that nodes running the same
+ * firmware spread their deadlines evenly over the period instead of
+ * transmitting in lockstep after a common power cycle. It is the same
+ * across reboots of a node. A random offset in [0, @p jitter] ms is added
+ * on top to separate nodes whose LUID hashes to the same phase.
+ *
+ * @note    Must be set before schedreg_register() and after the period
+ *
+ * @param[in] entry     The entry
+ * @param[in] jitter    Bound of the random offset in ms, 0 to disable
+ */
+void schedreg_set_node_phase(schedreg_t *entry, uint32_t jitter);
+#endif
+
+/**
+ * @brief   Sets the priority class and completion deadline of an entry
+ *
+ * Only used with `schedreg_workers`, otherwise callbacks are run in order
+ * of expiry by the schedreg thread.
+ *
+ * @note    Must be set before schedreg_register()
+ *
+ * @param[in] entry         The entry
+ * @param[in] prio          The priority class
+ * @param[in] rel_deadline  Time in ms after release by which the callback
+ *                          should complete, 0 to use the period
+ */
+static inline void schedreg_set_prio(schedreg_t *entry, schedreg_prio_t prio,
+                                     uint32_t rel_deadline)
+{
+    entry->prio = prio;
+    entry->rel_deadline = rel_deadline;
+}
+
+/**
+ * @brief   Sets the overrun policy of an entry
+ *
+ * @param[in] entry     The entry
+ * @param[in] overrun   The policy applied to missed runs
+ */
+static inline void schedreg_set_overrun(schedreg_t *entry,
+                                        schedreg_overrun_t overrun)
+{
+    entry->overrun = overrun;
+}
+
 /**
  * @brief   Removes an entry from registry
  *
+ * The entry timer is stopped and the slot generation is bumped, expiries
+ * still queued for the removed entry are discarded on reception. If the
+ * callback of @p entry is executing on another thread this blocks until it
+ * returns, @p entry and its argument can be released right after.
+ *
+ * @note    Called from the callback itself or from interrupt context this
+ *          does not block, the callback in progress runs to completion
+ *          and @p entry must not be released before.
+ *
  * @param[in] entry     An entry you want to remove from the registry.
  */
 void schedreg_unregister(schedreg_t *entry);
 
 
+/**
+ * @brief   Pauses a registered entry, its slot and handle are kept
+ *
+ * Can be called from any thread or from interrupt context.
+ *
+ * @param[in] handle    The entry handle, @ref schedreg_t::handle
+ *
+ * @return  0 on success
+ * @return  -ENOENT if @p handle is stale
+ */
+int schedreg_pause(uint32_t handle);
+
+/**
+ * @brief   Resumes a paused entry, the next run follows the same rules as
+ *          after schedreg_register()
+ *
+ * Can be called from any thread or from interrupt context.
+ *
+ * @param[in] handle    The entry handle, @ref schedreg_t::handle
+ *
+ * @return  0 on success
+ * @return  -ENOENT if @p handle is stale
+ */
+int schedreg_resume(uint32_t handle);
+
 /**
  * @name    Static entry initialization macros
  * @anchor  schedreg_init_static
@@ -80,7 +375,8 @@ void schedreg_unregister(schedreg_t *entry);
  *
  * @return  An initialized schedreg entry
  */
-#define SCHEDREG_INIT(cb, arg, msg, timer, period)  { NULL, cb, arg, msg, timer, period}
+#define SCHEDREG_INIT(cb, arg, msg, timer, period)  \
+    { cb, arg, msg, timer, period, SCHEDREG_HANDLE_INVALID }
 
 /**
  * @name    Dynamic entry initialization functions
@@ -105,26 +401,91 @@ static inline void schedreg_init_pid(schedreg_t *entry,
                                          ztimer_t* timer,
                                          uint32_t period)
 {
-    entry->next = NULL;
     entry->cb = cb;
     entry->arg = arg;
     entry->msg = msg;
     entry->timer = timer;
     entry->period = period;
+    entry->handle = SCHEDREG_HANDLE_INVALID;
+    entry->deadline = 0;
+    entry->slack = 0;
+    entry->phase = 0;
+    entry->lateness = 0;
+    entry->jitter = 0;
+    entry->rel_deadline = 0;
+    entry->flags = 0;
+    entry->prio = SCHEDREG_PRIO_NORMAL;
+    entry->overrun = SCHEDREG_OVERRUN_SKIP;
+#ifdef MODULE_SCHEDREG_STATS
+    memset(&entry->stats, 0, sizeof(entry->stats));
+#endif
 }
 
 /**
- * @brief   Executes the n element callback and re-schedule
+ * @brief   Executes the callback of the entry matching handle and re-schedule
  *
- * @param[in] n      nth element in linked list
+ * @param[in] handle the entry handle, as received in msg.content.value
  * @param[in] pid    the PID of that will handle scheduling
  *
+ * With `schedreg_single_timer` the shared timer is re-armed by the
+ * schedreg thread once all elapsed entries have been executed.
+ *
+ * @return  0 on success
+ * @return  1 if the handle is stale, i.e. the entry was unregistered
  */
-int schedreg_resched(int n, kernel_pid_t pid);
+int schedreg_resched(uint32_t handle, kernel_pid_t pid);
+
+/**
+ * @brief   Reads the schedreg thread wakeup counters
+ *
+ * @param[out] stats    The counters
+ */
+void schedreg_wakeup_stats(schedreg_wakeup_stats_t *stats);
+
+/**
+ * @brief   Static RAM the registry reserves per slot of
+ *          @ref CONFIG_SCHEDREG_NUMOF, which depends on the backend
+ *
+ * @return  size in bytes of the slot and of its heap or ready queue share
+ */
+size_t schedreg_slot_bytes(void);
+
+#if defined(MODULE_SCHEDREG_STATS) || defined(DOXYGEN)
+/**
+ * @brief   Formats the statistics of the entry in @p slot as one text line
+ *
+ * @param[in]  slot     The slot index, 0 to @ref CONFIG_SCHEDREG_NUMOF - 1
+ * @param[out] buf      The output buffer
+ * @param[in]  len      The size of @p buf
+ *
+ * @return  the length of the line, as snprintf()
+ * @return  -ENOENT if no entry is registered in @p slot
+ * @return  -EINVAL if @p slot is out of range
+ */
+int schedreg_stats_fmt(unsigned slot, char *buf, size_t len);
+
+/**
+ * @brief   Shell command printing the statistics of all registered entries
+ */
+int schedreg_stats_cmd(int argc, char **argv);
+
+#if defined(MODULE_GCOAP) || defined(DOXYGEN)
+/**
+ * @brief   CoAP handler returning the statistics of all registered entries,
+ *          one line per entry, using block2 if needed
+ */
+ssize_t schedreg_stats_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                               void *ctx);
+#endif
+#endif
 
 /**
  * @brief   Inits schedreg as main thread
  *
+ * With `schedreg_event` no thread is created, only the workers if any, and
+ * KERNEL_PID_UNDEF is returned: the pid given to schedreg_register() is
+ * then ignored.
+ *
  * @param[out] pid    pid of thread
  */
 int init_schedreg_thread(void);
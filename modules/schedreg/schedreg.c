@@ -1,90 +1,1045 @@
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "bitarithm.h"
+#include "irq.h"
 #include "thread.h"
+#ifdef MODULE_SCHEDREG_PHASE
+#include "luid.h"
+#include "random.h"
+#endif
+#ifdef MODULE_SCHEDREG_EVENT
+#include "kernel_defines.h"
+#include "event/thread.h"
+#endif
+#include "thread_flags.h"
 #include "ztimer.h"
-#include "utlist.h"
 
 #include "schedreg.h"
 
 #define ENABLE_DEBUG (0)
 #include "debug.h"
 
+#ifdef MODULE_SCHEDREG_EVENT
+/* expiries are handled by the shared event thread, no thread of our own */
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+static void _schedreg_expire(kernel_pid_t pid);
+#else
+static void _schedreg_expire(uint32_t handle, kernel_pid_t pid);
+#endif
+#else
 static msg_t _schedreg_msg_queue[CONFIG_SCHEDREG_QUEUE_SIZE];
 static char schedreg_stack[THREAD_STACKSIZE_DEFAULT];
+#endif
+
+#ifdef MODULE_SCHEDREG_WORKERS
+/* the timer thread only re-arms and queues jobs, it must preempt workers */
+#define SCHEDREG_THREAD_PRIO            (THREAD_PRIORITY_MAIN - 3)
+#define SCHEDREG_URGENT_WORKER_PRIO     (THREAD_PRIORITY_MAIN - 2)
+#define SCHEDREG_WORKER_PRIO            (THREAD_PRIORITY_MAIN - 1)
+#define SCHEDREG_WORKER_FLAG            (0x1)
+#else
+#define SCHEDREG_THREAD_PRIO            (THREAD_PRIORITY_MAIN - 1)
+#endif
+
+/**
+ * @brief   Flag waking up a schedreg_unregister() waiting for a callback to
+ *          return, clear of the event and core thread flags
+ */
+#define SCHEDREG_UNREGISTER_FLAG        (0x1000)
+
+/**
+ * @brief   Handle layout: slot index in the low bits, slot generation above
+ */
+#define SCHEDREG_HANDLE_SLOT_MASK       (0xFFFFU)
+#define SCHEDREG_HANDLE_GEN_SHIFT       (16U)
+
+/**
+ * @brief   Registry slot, the generation is bumped every time the slot is
+ *          released so that stale handles never match a live entry
+ */
+typedef struct {
+    schedreg_t *entry;
+    uint16_t gen;
+    kernel_pid_t pid;       /**< thread handling the entry expiries */
+    kernel_pid_t runner;    /**< thread running the callback, if any */
+    thread_t *waiter;       /**< unregistering thread waiting for the runner */
+    uint16_t pos;           /**< position of the slot in the deadline heap
+                                 with `schedreg_single_timer`, in the slack
+                                 list otherwise */
+#ifdef MODULE_SCHEDREG_WORKERS
+    bool busy;              /**< job queued or running on a worker */
+    uint8_t owed;           /**< runs released while busy */
+#endif
+} schedreg_slot_t;
+
+static schedreg_slot_t _slots[CONFIG_SCHEDREG_NUMOF];
+
+/**
+ * @brief   Stack of released slots, slots past @ref _slots_used were never
+ *          taken, so registering never scans the registry
+ */
+static uint16_t _free[CONFIG_SCHEDREG_NUMOF];
+static unsigned _free_len;
+static unsigned _slots_used;
+
+static schedreg_wakeup_stats_t _wakeup_stats;
+
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+/**
+ * @brief   Upper bound of the slack of all registered entries, bounds
+ *          coalescing scans
+ *
+ * Entries are counted per most significant bit of their slack so the bound
+ * is kept in constant time, it is at most twice the largest slack.
+ */
+static uint32_t _slack_max;
+static uint16_t _slack_hist[32];
+static uint32_t _slack_mask;
+
+/**
+ * @brief   Min-heap of slot indexes ordered by entry deadline, the single
+ *          timer is always armed for the entry at the top
+ */
+static uint16_t _heap[CONFIG_SCHEDREG_NUMOF];
+static unsigned _heap_len;
+#ifdef MODULE_SCHEDREG_EVENT
+static void _expire_handler(event_t *event)
+{
+    (void)event;
+    _schedreg_expire(KERNEL_PID_UNDEF);
+}
+
+static event_t _expire_event = { .handler = _expire_handler };
+
+/**
+ * @brief   Single timer callback, posting an already queued event is a no-op
+ *          so no expiry is ever lost
+ */
+static void _timer_cb(void *arg)
+{
+    (void)arg;
+    event_post(SCHEDREG_EVENT_QUEUE, &_expire_event);
+}
+#else
+static kernel_pid_t _timer_pid;
+static msg_t _timer_msg = { .type = CONFIG_SCHEDREG_TYPE,
+                            .content.value = SCHEDREG_HANDLE_INVALID };
+
+/**
+ * @brief   Single timer callback, if the expiry can not be queued another
+ *          one is already pending or the timer is re-armed to retry
+ */
+static void _timer_cb(void *arg)
+{
+    ztimer_t *timer = arg;
+
+    if (msg_send_int(&_timer_msg, _timer_pid) != 1) {
+        _wakeup_stats.dropped++;
+#ifdef MODULE_SCHEDREG_STATS
+        /* the timer is always armed for the top of the heap */
+        if (_heap_len) {
+            _slots[_heap[0]].entry->stats.dropped++;
+        }
+#endif
+        ztimer_set(ZTIMER_MSEC, timer, CONFIG_SCHEDREG_RETRY_DELAY);
+    }
+}
+#endif
+
+static ztimer_t _timer = { .callback = _timer_cb, .arg = &_timer };
+#endif
+
+#ifdef MODULE_SCHEDREG_WORKERS
+/**
+ * @brief   A released job waiting for a worker
+ */
+typedef struct {
+    uint32_t handle;
+    uint32_t deadline;      /**< time by which the job should be completed */
+    uint8_t prio;
+    uint8_t runs;           /**< number of back to back runs */
+} schedreg_job_t;
+
+/**
+ * @brief   Ready queue, sorted so that the next job to run is the last one:
+ *          highest class first, earliest deadline first within a class
+ */
+static schedreg_job_t _ready[CONFIG_SCHEDREG_NUMOF];
+static unsigned _ready_len;
+static kernel_pid_t _workers[CONFIG_SCHEDREG_WORKERS_NUMOF];
+static char _worker_stacks[CONFIG_SCHEDREG_WORKERS_NUMOF]
+                          [CONFIG_SCHEDREG_WORKER_STACKSIZE];
+#endif
+
+static inline uint32_t _handle(unsigned slot, uint16_t gen)
+{
+    return ((uint32_t)gen << SCHEDREG_HANDLE_GEN_SHIFT) | slot;
+}
+
+static inline unsigned _slot(uint32_t handle)
+{
+    return handle & SCHEDREG_HANDLE_SLOT_MASK;
+}
+
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+static void _slack_count(uint32_t slack, bool add)
+{
+    if (slack == 0) {
+        return;
+    }
+    unsigned b = bitarithm_msb(slack);
+    if (add) {
+        _slack_hist[b]++;
+        _slack_mask |= 1UL << b;
+    }
+    else if (--_slack_hist[b] == 0) {
+        _slack_mask &= ~(1UL << b);
+    }
+    if (_slack_mask == 0) {
+        _slack_max = 0;
+    }
+    else {
+        b = bitarithm_msb(_slack_mask);
+        /* deadlines are compared as signed 32 bit differences */
+        _slack_max = (b >= 30) ? INT32_MAX : (2UL << b) - 1;
+    }
+}
+
+/**
+ * @brief   Accounts the slack of the entry in @p slot, called with
+ *          interrupts disabled
+ */
+static inline void _slack_add(unsigned slot)
+{
+    _slack_count(_slots[slot].entry->slack, true);
+}
+
+/**
+ * @brief   Drops @p slack of the released @p slot, called with interrupts
+ *          disabled
+ */
+static inline void _slack_remove(unsigned slot, uint32_t slack)
+{
+    (void)slot;
+    _slack_count(slack, false);
+}
+#else
+/**
+ * @brief   Slots of the entries with a slack, the only ones an expiry scans
+ *          for coalescing
+ */
+static uint16_t _slack_slots[CONFIG_SCHEDREG_NUMOF];
+static unsigned _slack_len;
+
+/**
+ * @brief   Lists the entry of @p slot if it has a slack, called with
+ *          interrupts disabled
+ */
+static void _slack_add(unsigned slot)
+{
+    if (_slots[slot].entry->slack) {
+        _slots[slot].pos = _slack_len;
+        _slack_slots[_slack_len++] = slot;
+    }
+}
+
+/**
+ * @brief   Unlists the released @p slot, called with interrupts disabled
+ */
+static void _slack_remove(unsigned slot, uint32_t slack)
+{
+    if (slack) {
+        unsigned last = _slack_slots[--_slack_len];
+        _slack_slots[_slots[slot].pos] = last;
+        _slots[last].pos = _slots[slot].pos;
+    }
+}
+#endif
+
+/**
+ * @brief   An entry is due if it is not paused and its deadline falls within
+ *          its slack window
+ */
+static inline bool _due(schedreg_t *entry, uint32_t now)
+{
+    return !(entry->flags & SCHEDREG_FLAG_PAUSED) &&
+           (int32_t)(entry->deadline - now) <= (int32_t)entry->slack;
+}
+
+/**
+ * @brief   First deadline of an entry: right away for relative entries, the
+ *          next multiple of the period shifted by the phase for absolute ones
+ */
+static uint32_t _first_deadline(schedreg_t *entry, uint32_t now)
+{
+    if (!(entry->flags & SCHEDREG_FLAG_ABSOLUTE) || entry->period == 0) {
+        return now;
+    }
+    return now + (entry->period - (now - entry->phase) % entry->period) %
+           entry->period;
+}
+
+/**
+ * @brief   Records the dispatch lateness and updates the jitter estimate
+ *          (RFC 3550 estimator, J += (|D| - J) / 16)
+ */
+static void _timing_update(schedreg_t *entry, uint32_t now)
+{
+    int32_t lateness = now - entry->deadline;
+    int32_t diff = lateness - entry->lateness;
+
+    entry->jitter += (diff < 0 ? -diff : diff) - ((entry->jitter + 8) >> 4);
+    entry->lateness = lateness;
+}
+
+#ifdef MODULE_SCHEDREG_STATS
+/**
+ * @brief   Accounts a run, @p exec is the callback execution time in us
+ */
+static void _stats_update(schedreg_t *entry, uint32_t exec)
+{
+    schedreg_stats_t *stats = &entry->stats;
+
+    if (stats->runs == 0 || exec < stats->exec_min) {
+        stats->exec_min = exec;
+    }
+    if (exec > stats->exec_max) {
+        stats->exec_max = exec;
+    }
+    stats->exec_total += exec;
+    stats->runs++;
+    if (entry->lateness > 0 && (uint32_t)entry->lateness > stats->late_max) {
+        stats->late_max = entry->lateness;
+    }
+    /* 64 bit, periods above ~71 minutes overflow in us */
+    if (exec >= (uint64_t)entry->period * US_PER_MS) {
+        stats->overlaps++;
+    }
+}
+
+int schedreg_stats_fmt(unsigned slot, char *buf, size_t len)
+{
+    if (slot >= CONFIG_SCHEDREG_NUMOF) {
+        return -EINVAL;
+    }
+    unsigned state = irq_disable();
+    schedreg_t *entry = _slots[slot].entry;
+    if (entry == NULL) {
+        irq_restore(state);
+        return -ENOENT;
+    }
+    schedreg_stats_t stats = entry->stats;
+    uint32_t period = entry->period;
+    uint32_t jitter = entry->jitter;
+    irq_restore(state);
+
+    uint32_t avg = stats.runs ? (uint32_t)(stats.exec_total / stats.runs) : 0;
+    return snprintf(buf, len, "%u period:%"PRIu32" runs:%"PRIu32" "
+                    "exec:%"PRIu32"/%"PRIu32"/%"PRIu32"us "
+                    "late:%"PRIu32"ms jitter:%"PRIu32"ms "
+                    "missed:%"PRIu32" overlaps:%"PRIu32" "
+                    "dropped:%"PRIu32"\n",
+                    slot, period, stats.runs,
+                    stats.exec_min, avg, stats.exec_max,
+                    stats.late_max, (jitter + 8) >> 4,
+                    stats.missed, stats.overlaps, stats.dropped);
+}
+#endif
+
+static schedreg_t *_schedreg_lookup(uint32_t handle)
+{
+    unsigned slot = _slot(handle);
+
+    if (slot >= CONFIG_SCHEDREG_NUMOF) {
+        return NULL;
+    }
+    if (_slots[slot].gen != (handle >> SCHEDREG_HANDLE_GEN_SHIFT)) {
+        return NULL;
+    }
+    return _slots[slot].entry;
+}
+
+/**
+ * @brief   Number of missed runs an entry may still execute
+ */
+static inline unsigned _overrun_max(const schedreg_t *entry)
+{
+    switch (entry->overrun) {
+    case SCHEDREG_OVERRUN_CATCH_UP:
+        return 1;
+    case SCHEDREG_OVERRUN_BURST:
+        return CONFIG_SCHEDREG_BURST_MAX;
+    default:
+        return 0;
+    }
+}
+
+#ifndef MODULE_SCHEDREG_SINGLE_TIMER
+#ifdef MODULE_SCHEDREG_EVENT
+static void _entry_event_handler(event_t *event)
+{
+    schedreg_t *entry = container_of(event, schedreg_t, event);
+    _schedreg_expire(entry->handle, KERNEL_PID_UNDEF);
+}
+
+/**
+ * @brief   Entry timer callback, posts the event embedded in the entry
+ */
+static void _entry_timer_cb(void *arg)
+{
+    schedreg_t *entry = arg;
+    event_post(SCHEDREG_EVENT_QUEUE, &entry->event);
+}
+#else
+/**
+ * @brief   Entry timer callback, if the expiry can not be queued the timer
+ *          is re-armed right away so the entry never stops
+ */
+static void _entry_timer_cb(void *arg)
+{
+    schedreg_t *entry = arg;
+
+    if (msg_send_int(entry->msg, _slots[_slot(entry->handle)].pid) != 1) {
+        _wakeup_stats.dropped++;
+#ifdef MODULE_SCHEDREG_STATS
+        entry->stats.dropped++;
+#endif
+        /* skipping entries wait for their next period, others retry soon so
+           the lost run can be caught up */
+        ztimer_set(ZTIMER_MSEC, entry->timer,
+                   entry->overrun == SCHEDREG_OVERRUN_SKIP ?
+                   entry->period : CONFIG_SCHEDREG_RETRY_DELAY);
+    }
+}
+#endif
+
+static void _entry_arm(schedreg_t *entry, kernel_pid_t pid)
+{
+    (void)pid;
+    int32_t diff = entry->deadline - ztimer_now(ZTIMER_MSEC);
+    entry->timer->callback = _entry_timer_cb;
+    entry->timer->arg = entry;
+    ztimer_set(ZTIMER_MSEC, entry->timer, diff > 0 ? (uint32_t)diff : 0);
+}
+#endif
+
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+static inline bool _before(unsigned a, unsigned b)
+{
+    return (int32_t)(_slots[_heap[a]].entry->deadline -
+                     _slots[_heap[b]].entry->deadline) < 0;
+}
+
+static void _heap_swap(unsigned a, unsigned b)
+{
+    uint16_t tmp = _heap[a];
+    _heap[a] = _heap[b];
+    _heap[b] = tmp;
+    _slots[_heap[a]].pos = a;
+    _slots[_heap[b]].pos = b;
+}
+
+static void _heap_up(unsigned i)
+{
+    while (i > 0 && _before(i, (i - 1) / 2)) {
+        _heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void _heap_down(unsigned i)
+{
+    while (1) {
+        unsigned min = i;
+        unsigned l = 2 * i + 1;
+        unsigned r = l + 1;
+        if (l < _heap_len && _before(l, min)) {
+            min = l;
+        }
+        if (r < _heap_len && _before(r, min)) {
+            min = r;
+        }
+        if (min == i) {
+            return;
+        }
+        _heap_swap(i, min);
+        i = min;
+    }
+}
+
+static void _heap_insert(unsigned slot)
+{
+    _heap[_heap_len] = slot;
+    _slots[slot].pos = _heap_len;
+    _heap_up(_heap_len++);
+}
+
+static void _heap_remove(unsigned slot)
+{
+    unsigned i = _slots[slot].pos;
+    if (i != --_heap_len) {
+        _heap_swap(i, _heap_len);
+        _heap_down(i);
+        _heap_up(i);
+    }
+}
+
+static void _heap_update(unsigned slot)
+{
+    _heap_down(_slots[slot].pos);
+    _heap_up(_slots[slot].pos);
+}
 
 /**
- * @brief   Keep the head of the registers thread as global variable
+ * @brief   Arm the single timer for the earliest deadline
  */
-schedreg_t *schedreg = NULL;
+static void _timer_arm(kernel_pid_t pid)
+{
+    if (_heap_len == 0) {
+        ztimer_remove(ZTIMER_MSEC, &_timer);
+        return;
+    }
+    int32_t diff = _slots[_heap[0]].entry->deadline - ztimer_now(ZTIMER_MSEC);
+#ifdef MODULE_SCHEDREG_EVENT
+    (void)pid;
+#else
+    _timer_pid = pid;
+#endif
+    ztimer_set(ZTIMER_MSEC, &_timer, diff > 0 ? (uint32_t)diff : 0);
+}
 
-static schedreg_t *_schedreg_find_nth(int pos)
+/**
+ * @brief   Collect handles of all due entries, subtrees whose root deadline
+ *          is beyond the largest slack window are pruned
+ */
+static void _heap_collect(unsigned i, uint32_t now, uint32_t *due, unsigned *n)
 {
-    schedreg_t *tmp = schedreg;
+    if (i >= _heap_len) {
+        return;
+    }
+    schedreg_t *tmp = _slots[_heap[i]].entry;
+    if ((int32_t)(tmp->deadline - now) > (int32_t)_slack_max) {
+        return;
+    }
+    if (_due(tmp, now)) {
+        due[(*n)++] = tmp->handle;
+        if ((int32_t)(tmp->deadline - now) > 0) {
+            _wakeup_stats.saved++;
+        }
+    }
+    _heap_collect(2 * i + 1, now, due, n);
+    _heap_collect(2 * i + 2, now, due, n);
+}
 
-    for (int i = 0; (i < pos) && tmp; i++) {
-        tmp = tmp->next;
+/**
+ * @brief   Run every due entry back to back, then re-arm
+ */
+static void _schedreg_expire(kernel_pid_t pid)
+{
+    uint32_t due[CONFIG_SCHEDREG_NUMOF];
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    unsigned n = 0;
+
+    unsigned state = irq_disable();
+    _heap_collect(0, now, due, &n);
+    irq_restore(state);
+    if (n) {
+        _wakeup_stats.wakeups++;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        schedreg_resched(due[i], pid);
     }
-    return tmp;
+    state = irq_disable();
+    _timer_arm(pid);
+    irq_restore(state);
 }
+#endif
 
-static int _schedreg_num(void)
+/**
+ * @brief   Executes the entry callback @p runs times back to back
+ */
+static void _schedreg_run(schedreg_t *entry, unsigned runs)
 {
-    int num = 0;
-    schedreg_t *tmp = schedreg;
-    while(tmp != NULL) {
-        tmp = tmp->next;
-        num++;
+    while (runs--) {
+#ifdef MODULE_SCHEDREG_STATS
+        uint32_t start = ztimer_now(ZTIMER_USEC);
+        entry->cb(entry->arg);
+        _stats_update(entry, ztimer_now(ZTIMER_USEC) - start);
+#else
+        entry->cb(entry->arg);
+#endif
     }
-    return num;
 }
 
-static void _schedreg_update(void)
+/**
+ * @brief   Marks the callback of the entry in @p slot as running on the
+ *          calling thread, called with interrupts disabled
+ */
+static inline void _run_begin(unsigned slot)
 {
-    schedreg_t *tmp = schedreg;
-    int count = _schedreg_num();
+    _slots[slot].runner = thread_getpid();
+}
+
+/**
+ * @brief   Marks the callback of the entry in @p slot as returned and wakes
+ *          up an unregister waiting for it, called with interrupts disabled
+ */
+static void _run_end(unsigned slot)
+{
+    _slots[slot].runner = KERNEL_PID_UNDEF;
+    /* the release of an entry unregistered while running was deferred */
+    if (_slots[slot].entry == NULL) {
+        _free[_free_len++] = slot;
+    }
+    if (_slots[slot].waiter) {
+        thread_flags_set(_slots[slot].waiter, SCHEDREG_UNREGISTER_FLAG);
+        _slots[slot].waiter = NULL;
+    }
+}
+
+#ifdef MODULE_SCHEDREG_WORKERS
+static inline bool _job_before(const schedreg_job_t *a, const schedreg_job_t *b)
+{
+    if (a->prio != b->prio) {
+        return a->prio > b->prio;
+    }
+    return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+/**
+ * @brief   Queues a job and wakes up the workers allowed to run it
+ *
+ * If the previous job of that entry is still queued or running the runs
+ * are owed to it as allowed by the entry overrun policy, the others are
+ * counted as missed.
+ *
+ * @return  number of runs that were neither queued nor owed
+ */
+static unsigned _ready_push(uint32_t handle, uint32_t deadline, unsigned runs)
+{
+    unsigned slot = _slot(handle);
+
+    unsigned state = irq_disable();
+    schedreg_t *tmp = _schedreg_lookup(handle);
+    if (tmp == NULL) {
+        irq_restore(state);
+        return 0;
+    }
+    if (_slots[slot].busy) {
+        unsigned max = _overrun_max(tmp);
+        unsigned owed = _slots[slot].owed + runs;
+        unsigned dropped = owed > max ? owed - max : 0;
+        _slots[slot].owed = owed - dropped;
+#ifdef MODULE_SCHEDREG_STATS
+        tmp->stats.missed += dropped;
+#endif
+        irq_restore(state);
+        return dropped;
+    }
+    schedreg_job_t job = { .handle = handle, .deadline = deadline,
+                           .prio = tmp->prio, .runs = runs };
+    _slots[slot].busy = true;
+    unsigned i = _ready_len++;
+    while (i > 0 && _job_before(&_ready[i - 1], &job)) {
+        _ready[i] = _ready[i - 1];
+        i--;
+    }
+    _ready[i] = job;
+    irq_restore(state);
+
+    for (unsigned w = 0; w < CONFIG_SCHEDREG_WORKERS_NUMOF; w++) {
+        /* worker 0 is reserved to urgent jobs when there is more than one */
+        if (w == 0 && CONFIG_SCHEDREG_WORKERS_NUMOF > 1 &&
+            job.prio != SCHEDREG_PRIO_HIGH) {
+            continue;
+        }
+        thread_flags_set(thread_get(_workers[w]), SCHEDREG_WORKER_FLAG);
+    }
+    return 0;
+}
+
+/**
+ * @brief   Drops the queued job of an entry, called with interrupts disabled
+ *
+ * A job already taken by a worker is left alone: the slot stays busy until
+ * that worker is done, it then drops the runs owed to a stopped entry.
+ */
+static void _ready_remove(uint32_t handle)
+{
+    for (unsigned i = 0; i < _ready_len; i++) {
+        if (_ready[i].handle == handle) {
+            memmove(&_ready[i], &_ready[i + 1],
+                    (_ready_len - i - 1) * sizeof(_ready[0]));
+            _ready_len--;
+            _slots[_slot(handle)].busy = false;
+            _slots[_slot(handle)].owed = 0;
+            return;
+        }
+    }
+}
+
+static void *_worker_thread(void *arg)
+{
+    bool urgent_only = (bool)(uintptr_t)arg;
+    schedreg_job_t job;
+
+    while (1) {
+        unsigned state = irq_disable();
+        if (_ready_len == 0 ||
+            (urgent_only && _ready[_ready_len - 1].prio != SCHEDREG_PRIO_HIGH)) {
+            irq_restore(state);
+            thread_flags_wait_any(SCHEDREG_WORKER_FLAG);
+            continue;
+        }
+        job = _ready[--_ready_len];
+        unsigned slot = _slot(job.handle);
+        schedreg_t *tmp = _schedreg_lookup(job.handle);
+        unsigned runs = tmp ? job.runs : 0;
+        _slots[slot].busy = (runs != 0);
+        if (runs) {
+            _run_begin(slot);
+        }
+        irq_restore(state);
 
-    for (int i = 0; (i < count); i++) {
-        tmp->msg->type = i + CONFIG_SCHEDREG_TYPE;
-        tmp = tmp->next;
+        /* run the job, then any run owed to it meanwhile, the slot stays busy
+           until then so the entry never runs on two workers at once */
+        while (runs) {
+            _schedreg_run(tmp, runs);
+            state = irq_disable();
+            tmp = _schedreg_lookup(job.handle);
+            runs = _slots[slot].owed;
+            _slots[slot].owed = 0;
+            /* runs owed to a paused or unregistered entry are dropped */
+            if (tmp == NULL || (tmp->flags & SCHEDREG_FLAG_PAUSED)) {
+                runs = 0;
+            }
+            _slots[slot].busy = (runs != 0);
+            if (runs == 0) {
+                _run_end(slot);
+            }
+            irq_restore(state);
+        }
     }
+
+    return NULL;
+}
+#endif
+
+/**
+ * @brief   Arms a (re)started entry for its first deadline, called with
+ *          interrupts disabled
+ */
+static void _schedreg_start(schedreg_t *entry, unsigned slot)
+{
+    entry->deadline = _first_deadline(entry, ztimer_now(ZTIMER_MSEC));
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+    _heap_insert(slot);
+    _timer_arm(_slots[slot].pid);
+#elif defined(MODULE_SCHEDREG_EVENT)
+    entry->event.handler = _entry_event_handler;
+    _entry_arm(entry, _slots[slot].pid);
+#else
+    entry->msg->type = CONFIG_SCHEDREG_TYPE;
+    entry->msg->content.value = entry->handle;
+    _entry_arm(entry, _slots[slot].pid);
+#endif
+}
+
+/**
+ * @brief   Disarms an entry, called with interrupts disabled
+ */
+static void _schedreg_stop(schedreg_t *entry, unsigned slot)
+{
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+    /* the single timer is left armed, a spurious expiry is harmless */
+    _heap_remove(slot);
+    (void)entry;
+#else
+    (void)slot;
+    ztimer_remove(ZTIMER_MSEC, entry->timer);
+#ifdef MODULE_SCHEDREG_EVENT
+    event_cancel(SCHEDREG_EVENT_QUEUE, &entry->event);
+#endif
+#endif
+#ifdef MODULE_SCHEDREG_WORKERS
+    _ready_remove(entry->handle);
+#endif
 }
 
 int schedreg_register(schedreg_t *entry, kernel_pid_t pid)
 {
-    int count = _schedreg_num();
-    if( count >= 0xFF) {
+    if (entry == NULL) {
+        return -EINVAL;
+    }
+#if !defined(MODULE_SCHEDREG_SINGLE_TIMER) && !defined(MODULE_SCHEDREG_EVENT)
+    if (entry->msg == NULL || entry->timer == NULL) {
+        return -EINVAL;
+    }
+#elif !defined(MODULE_SCHEDREG_SINGLE_TIMER)
+    if (entry->timer == NULL) {
+        return -EINVAL;
+    }
+#endif
+    unsigned state = irq_disable();
+    if (_schedreg_lookup(entry->handle) == entry) {
+        irq_restore(state);
+        return -EINVAL;
+    }
+    unsigned i;
+    if (_free_len) {
+        i = _free[--_free_len];
+    }
+    else if (_slots_used < CONFIG_SCHEDREG_NUMOF) {
+        i = _slots_used++;
+    }
+    else {
+        irq_restore(state);
         DEBUG("[DEBUG] schedreg: registry full \n");
-        return 1;
+        return -ENOMEM;
+    }
+    _slots[i].entry = entry;
+    _slots[i].pid = pid;
+    entry->handle = _handle(i, _slots[i].gen);
+    entry->flags &= ~SCHEDREG_FLAG_PAUSED;
+    if (entry->flags & SCHEDREG_FLAG_NODE_PHASE) {
+        _wakeup_stats.offsets++;
     }
-    entry->msg->type = CONFIG_SCHEDREG_TYPE + count;
-    LL_APPEND(schedreg, entry);
-    schedreg_resched(count, pid);
+    entry->lateness = 0;
+    entry->jitter = 0;
+#ifdef MODULE_SCHEDREG_STATS
+    memset(&entry->stats, 0, sizeof(entry->stats));
+#endif
+    _slack_add(i);
+    /* first run is executed by the schedreg thread */
+    _schedreg_start(entry, i);
+    irq_restore(state);
     return 0;
 }
 
 void schedreg_unregister(schedreg_t *entry)
 {
-    LL_DELETE(schedreg, entry);
-    _schedreg_update();
+    unsigned state = irq_disable();
+    if (_schedreg_lookup(entry->handle) != entry) {
+        irq_restore(state);
+        return;
+    }
+    unsigned slot = _slot(entry->handle);
+    if (!(entry->flags & SCHEDREG_FLAG_PAUSED)) {
+        _schedreg_stop(entry, slot);
+    }
+    _slots[slot].entry = NULL;
+    _slots[slot].gen++;
+    entry->handle = SCHEDREG_HANDLE_INVALID;
+    _slack_remove(slot, entry->slack);
+    /* a released slot is reused once its last callback returned */
+    if (_slots[slot].runner == KERNEL_PID_UNDEF) {
+        _free[_free_len++] = slot;
+    }
+    /* wait for a callback in progress on another thread, the thread flag
+       is latched so a run ending before the wait is not missed */
+    bool wait = _slots[slot].runner != KERNEL_PID_UNDEF &&
+                _slots[slot].runner != thread_getpid() && !irq_is_in();
+    if (wait) {
+        _slots[slot].waiter = thread_get_active();
+    }
+    irq_restore(state);
+    if (wait) {
+        thread_flags_wait_any(SCHEDREG_UNREGISTER_FLAG);
+    }
 }
 
-int schedreg_resched(int n, kernel_pid_t pid)
+int schedreg_pause(uint32_t handle)
 {
-    schedreg_t *tmp = _schedreg_find_nth(n);
-    if(tmp) {
-        DEBUG("[DEBUG] schedreg: re-scheduling entry %d in %lu \n", n, tmp->period);
-        ztimer_set_msg(ZTIMER_MSEC, tmp->timer, tmp->period, tmp->msg, pid);
-        tmp->cb(tmp->arg);
-        return 0;
+    unsigned state = irq_disable();
+    schedreg_t *tmp = _schedreg_lookup(handle);
+    if (tmp == NULL) {
+        irq_restore(state);
+        return -ENOENT;
     }
-    else {
-        DEBUG("[DEBUG] schedreg:  entry %d not found\n", n);
+    if (!(tmp->flags & SCHEDREG_FLAG_PAUSED)) {
+        _schedreg_stop(tmp, _slot(handle));
+        tmp->flags |= SCHEDREG_FLAG_PAUSED;
+    }
+    irq_restore(state);
+    return 0;
+}
+
+int schedreg_resume(uint32_t handle)
+{
+    unsigned state = irq_disable();
+    schedreg_t *tmp = _schedreg_lookup(handle);
+    if (tmp == NULL) {
+        irq_restore(state);
+        return -ENOENT;
+    }
+    if (tmp->flags & SCHEDREG_FLAG_PAUSED) {
+        tmp->flags &= ~SCHEDREG_FLAG_PAUSED;
+        _schedreg_start(tmp, _slot(handle));
+    }
+    irq_restore(state);
+    return 0;
+}
+
+int schedreg_resched(uint32_t handle, kernel_pid_t pid)
+{
+    /* the entry is re-armed with interrupts disabled so that a concurrent
+       schedreg_unregister() can never leave its timer armed */
+    unsigned state = irq_disable();
+    schedreg_t *tmp = _schedreg_lookup(handle);
+    if (tmp == NULL || (tmp->flags & SCHEDREG_FLAG_PAUSED)) {
+        irq_restore(state);
+        DEBUG("[DEBUG] schedreg: stale entry %"PRIx32" dropped\n", handle);
         return 1;
     }
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+#ifdef MODULE_SCHEDREG_WORKERS
+    uint32_t job_deadline = tmp->deadline +
+        (tmp->rel_deadline ? tmp->rel_deadline : tmp->period);
+#endif
+    /* deadlines elapsed before this one, e.g. because expiries were lost or
+       the previous run overlapped, are run or dropped as per overrun policy */
+    unsigned missed = 0;
+    if (tmp->period && (int32_t)(now - tmp->deadline) >= (int32_t)tmp->period) {
+        missed = (now - tmp->deadline) / tmp->period;
+    }
+    unsigned extra = missed > _overrun_max(tmp) ? _overrun_max(tmp) : missed;
+#ifdef MODULE_SCHEDREG_STATS
+    tmp->stats.missed += missed - extra;
+#endif
+    _timing_update(tmp, now);
+    if ((tmp->flags & SCHEDREG_FLAG_ABSOLUTE) && tmp->period) {
+        /* next deadline derives from the previous one, never from now,
+           elapsed deadlines are skipped */
+        tmp->deadline += tmp->period;
+        if ((int32_t)(tmp->deadline - now) <= 0) {
+            tmp->deadline += ((now - tmp->deadline) / tmp->period + 1) *
+                             tmp->period;
+        }
+    }
+    else {
+        tmp->deadline = now + tmp->period;
+    }
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+    (void)pid;
+    _heap_update(_slot(handle));
+#else
+    _entry_arm(tmp, pid);
+#endif
+#ifndef MODULE_SCHEDREG_WORKERS
+    _run_begin(_slot(handle));
+#endif
+    irq_restore(state);
+    DEBUG("[DEBUG] schedreg: re-scheduling entry %"PRIx32" at %"PRIu32" \n",
+          handle, tmp->deadline);
+
+#ifdef MODULE_SCHEDREG_WORKERS
+    if (_ready_push(handle, job_deadline, 1 + extra)) {
+        DEBUG("[DEBUG] schedreg: entry %"PRIx32" still running\n", handle);
+    }
+#else
+    _schedreg_run(tmp, 1 + extra);
+    state = irq_disable();
+    _run_end(_slot(handle));
+    irq_restore(state);
+#endif
+    return 0;
+}
+
+#ifndef MODULE_SCHEDREG_SINGLE_TIMER
+/**
+ * @brief   Run the expired entry, then every other entry whose deadline falls
+ *          within its slack window so they share the same wakeup
+ */
+static void _schedreg_expire(uint32_t handle, kernel_pid_t pid)
+{
+    uint32_t now = ztimer_now(ZTIMER_MSEC);
+    unsigned state = irq_disable();
+    schedreg_t *tmp = _schedreg_lookup(handle);
+    bool due = tmp && _due(tmp, now);
+    irq_restore(state);
+
+    /* entry was either removed or already run within another wakeup */
+    if (!due) {
+        DEBUG("[DEBUG] schedreg: stale entry %"PRIx32" dropped\n", handle);
+        return;
+    }
+    _wakeup_stats.wakeups++;
+    schedreg_resched(handle, pid);
+    /* only entries with a slack can be pulled forward, the list may change
+       between two of them, an entry missed then runs on its own expiry */
+    for (unsigned i = 0; ; i++) {
+        uint32_t other = SCHEDREG_HANDLE_INVALID;
+        state = irq_disable();
+        if (i >= _slack_len) {
+            irq_restore(state);
+            break;
+        }
+        tmp = _slots[_slack_slots[i]].entry;
+        if (tmp->handle != handle && _due(tmp, now)) {
+            if ((int32_t)(tmp->deadline - now) > 0) {
+                _wakeup_stats.saved++;
+            }
+            other = tmp->handle;
+        }
+        irq_restore(state);
+        if (other != SCHEDREG_HANDLE_INVALID) {
+            schedreg_resched(other, pid);
+        }
+    }
+}
+#endif
+
+void schedreg_wakeup_stats(schedreg_wakeup_stats_t *stats)
+{
+    *stats = _wakeup_stats;
+}
+
+size_t schedreg_slot_bytes(void)
+{
+    size_t bytes = sizeof(schedreg_slot_t) + sizeof(_free[0]);
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+    bytes += sizeof(_heap[0]);
+#else
+    bytes += sizeof(_slack_slots[0]);
+#endif
+#ifdef MODULE_SCHEDREG_WORKERS
+    bytes += sizeof(_ready[0]);
+#endif
+    return bytes;
 }
 
+#ifdef MODULE_SCHEDREG_PHASE
+uint32_t schedreg_node_offset(uint32_t jitter)
+{
+    uint8_t luid[8];
+    /* FNV-1a over the LUID base, stable across reboots */
+    uint32_t hash = 2166136261U;
+
+    luid_base(luid, sizeof(luid));
+    for (unsigned i = 0; i < sizeof(luid); i++) {
+        hash = (hash ^ luid[i]) * 16777619U;
+    }
+    if (jitter) {
+        hash += random_uint32_range(0, jitter + 1);
+    }
+    return hash;
+}
+
+void schedreg_set_node_phase(schedreg_t *entry, uint32_t jitter)
+{
+    uint32_t offset = schedreg_node_offset(jitter);
+
+    schedreg_set_absolute(entry, entry->period ? offset % entry->period : 0);
+    entry->flags |= SCHEDREG_FLAG_NODE_PHASE;
+    DEBUG("[schedreg]: node phase %" PRIu32 " ms\n", entry->phase);
+}
+#endif
+
+#ifndef MODULE_SCHEDREG_EVENT
 static void *schedreg_thread(void *args)
 {
     (void) args;
@@ -94,8 +1049,12 @@ static void *schedreg_thread(void *args)
     while(msg_receive(&msg))
     {
         DEBUG("[DEBUG] schedreg: msg received \n");
-        if(msg.type >= CONFIG_SCHEDREG_TYPE ) {
-            schedreg_resched(msg.type - CONFIG_SCHEDREG_TYPE, thread_getpid());
+        if(msg.type == CONFIG_SCHEDREG_TYPE ) {
+#ifdef MODULE_SCHEDREG_SINGLE_TIMER
+            _schedreg_expire(thread_getpid());
+#else
+            _schedreg_expire(msg.content.value, thread_getpid());
+#endif
         }
         else {
             DEBUG("[DEBUG] schedreg: unknown msg typereceived\n");
@@ -104,11 +1063,30 @@ static void *schedreg_thread(void *args)
 
     return NULL;
 }
+#endif
 
 int init_schedreg_thread(void)
 {
+#ifdef MODULE_SCHEDREG_WORKERS
+    for (unsigned w = 0; w < CONFIG_SCHEDREG_WORKERS_NUMOF; w++) {
+        bool urgent = (w == 0 && CONFIG_SCHEDREG_WORKERS_NUMOF > 1);
+        _workers[w] = thread_create(_worker_stacks[w], sizeof(_worker_stacks[w]),
+                                    urgent ? SCHEDREG_URGENT_WORKER_PRIO
+                                           : SCHEDREG_WORKER_PRIO,
+                                    THREAD_CREATE_STACKTEST, _worker_thread,
+                                    (void *)(uintptr_t)urgent,
+                                    "Schedreg worker");
+        if (_workers[w] == -EINVAL || _workers[w] == -EOVERFLOW) {
+            puts("Error: failed to create schedreg worker, exiting\n");
+            return _workers[w];
+        }
+    }
+#endif
+#ifdef MODULE_SCHEDREG_EVENT
+    return KERNEL_PID_UNDEF;
+#else
     int schedreg_pid = thread_create(schedreg_stack, sizeof(schedreg_stack),
-                                   THREAD_PRIORITY_MAIN - 1,
+                                   SCHEDREG_THREAD_PRIO,
                                    THREAD_CREATE_STACKTEST, schedreg_thread,
                                    NULL, "Schedreg thread");
     if (schedreg_pid == -EINVAL || schedreg_pid == -EOVERFLOW) {
@@ -119,4 +1097,5 @@ int init_schedreg_thread(void)
         puts("Successfuly created schedreg thread !\n");
         return schedreg_pid;
     }
+#endif
 }
@@ -0,0 +1,67 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "schedreg.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/**
+ * @brief   Longest line produced by schedreg_stats_fmt()
+ */
+#define SCHEDREG_STATS_LINE_LEN     (128U)
+
+int schedreg_stats_cmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    char line[SCHEDREG_STATS_LINE_LEN];
+    schedreg_wakeup_stats_t wakeups;
+
+    schedreg_wakeup_stats(&wakeups);
+    printf("wakeups:%"PRIu32" saved:%"PRIu32" dropped:%"PRIu32
+           " offsets:%"PRIu32"\n",
+           wakeups.wakeups, wakeups.saved, wakeups.dropped, wakeups.offsets);
+    for (unsigned i = 0; i < CONFIG_SCHEDREG_NUMOF; i++) {
+        if (schedreg_stats_fmt(i, line, sizeof(line)) > 0) {
+            printf("%s", line);
+        }
+    }
+    return 0;
+}
+
+#ifdef MODULE_GCOAP
+ssize_t schedreg_stats_handler(coap_pkt_t* pdu, uint8_t *buf, size_t len,
+                               void *ctx)
+{
+    (void)ctx;
+    char line[SCHEDREG_STATS_LINE_LEN];
+    schedreg_wakeup_stats_t wakeups;
+    coap_block_slicer_t slicer;
+
+    coap_block2_init(pdu, &slicer);
+    gcoap_resp_init(pdu, buf, len, COAP_CODE_CONTENT);
+    coap_opt_add_format(pdu, COAP_FORMAT_TEXT);
+    coap_opt_add_block2(pdu, &slicer, 1);
+    ssize_t plen = coap_opt_finish(pdu, COAP_OPT_FINISH_PAYLOAD);
+    uint8_t *pos = pdu->payload;
+
+    schedreg_wakeup_stats(&wakeups);
+    int p = snprintf(line, sizeof(line),
+                     "wakeups:%"PRIu32" saved:%"PRIu32" dropped:%"PRIu32
+                     " offsets:%"PRIu32"\n",
+                     wakeups.wakeups, wakeups.saved, wakeups.dropped,
+                     wakeups.offsets);
+    pos += coap_blockwise_put_bytes(&slicer, pos, (uint8_t *)line, p);
+    for (unsigned i = 0; i < CONFIG_SCHEDREG_NUMOF; i++) {
+        p = schedreg_stats_fmt(i, line, sizeof(line));
+        if (p > 0) {
+            pos += coap_blockwise_put_bytes(&slicer, pos, (uint8_t *)line, p);
+        }
+    }
+    coap_block2_finish(&slicer);
+
+    return plen + (pos - pdu->payload);
+}
+#endif